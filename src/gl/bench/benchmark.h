@@ -0,0 +1,487 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <glm/glm.hpp>
+
+#include "camera/camera.h"
+#include "model/texture.h"
+
+// EGL surfaceless works with Mesa (llvmpipe included) and needs neither X11 nor Wayland.
+// Other platforms fall back to a hidden GLFW window.
+#if defined(__linux__) && !defined(OGL_BENCH_NO_EGL)
+#define OGL_BENCH_EGL 1
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/*
+Headless benchmark:
+
+    * create a GL 3.3 core context without a visible window
+    * render a fixed number of frames into an offscreen FBO
+    * the camera orbits around a target, so every run sees the same frames
+    * CPU time is the submission time of a frame, GPU time comes from GL_TIME_ELAPSED queries
+
+    Queries are kept in a small ring and read back a few frames later, so the timer never stalls the pipeline.
+*/
+
+namespace bench
+{
+
+struct Options
+{
+    bool headless = false;
+    unsigned int width  = 1600;
+    unsigned int height = 1200;
+    unsigned int warmup = 10;  // frames rendered but not recorded
+    unsigned int frames = 300;
+
+    // scripted camera
+    glm::vec3 target = glm::vec3(0.0f, 0.0f, 0.0f);
+    float orbitRadius = 20.0f;
+    float orbitHeight = 0.0f;
+
+    unsigned int copies = 1; // of the model on a grid around the target, > 1 draws them with Model::DrawInstanced
+
+    std::string jsonPath; // empty: print to stdout
+};
+
+struct Stats
+{
+    double mean = 0.0;
+    double p50  = 0.0;
+    double p99  = 0.0;
+};
+
+struct Report
+{
+    std::string renderer;
+    unsigned int width  = 0;
+    unsigned int height = 0;
+    unsigned int copies = 1;
+    double loadMs = 0.0;
+
+    std::vector<double> cpuMs;
+    std::vector<double> gpuMs;
+    // per recorded frame, filled by the caller from the model's DrawStats
+    std::vector<double> visibleMeshes;
+    std::vector<double> culledMeshes;
+    std::vector<double> occludedMeshes;
+    std::vector<double> skippedDraws; // conditional draws the gpu dropped
+
+    std::vector<model::TextureTiming> textures;
+};
+
+// context without window
+class HeadlessContext
+{
+public:
+    ~HeadlessContext() { destroy(); }
+
+    bool create();
+    void destroy();
+
+private:
+#ifdef OGL_BENCH_EGL
+    EGLDisplay m_display = EGL_NO_DISPLAY;
+    EGLContext m_context = EGL_NO_CONTEXT;
+#else
+    GLFWwindow* m_window = nullptr;
+#endif
+};
+
+// color + depth render target
+class Framebuffer
+{
+public:
+    ~Framebuffer() { destroy(); }
+
+    bool create(const unsigned int width, const unsigned int height);
+    void destroy();
+    void bind() const { glBindFramebuffer(GL_FRAMEBUFFER, m_fbo); }
+
+private:
+    unsigned int m_fbo   = 0;
+    unsigned int m_color = 0;
+    unsigned int m_depth = 0;
+};
+
+// per frame CPU and GPU timing
+class FrameTimer
+{
+public:
+    static const unsigned int QUERY_RING = 4;
+
+    FrameTimer()  { glGenQueries(QUERY_RING, m_queries); }
+    ~FrameTimer() { glDeleteQueries(QUERY_RING, m_queries); }
+
+    void begin();
+    void end(const bool record);
+    // blocks until every pending query has a result
+    void flush();
+
+    const std::vector<double>& cpuMs() const { return m_cpuMs; }
+    const std::vector<double>& gpuMs() const { return m_gpuMs; }
+
+private:
+    void collect(const unsigned int slot);
+
+private:
+    unsigned int m_queries[QUERY_RING];
+    bool m_pending[QUERY_RING] = {};
+    bool m_record[QUERY_RING]  = {};
+    unsigned int m_frame = 0;
+
+    std::chrono::steady_clock::time_point m_cpuBegin;
+
+    std::vector<double> m_cpuMs;
+    std::vector<double> m_gpuMs;
+};
+
+Stats summarize(std::vector<double> samples);
+
+// camera at frame [frame] of a full orbit of [frames] frames
+cam::Camera scriptedCamera(const Options& opt, const unsigned int frame);
+
+// renders warmup + frames frames into an FBO, drawFrame is responsible for clearing and drawing
+Report run(const Options& opt, const std::function<void(cam::Camera&)>& drawFrame);
+
+void writeJson(std::ostream& os, const Report& report);
+
+//////////////////// IMPLEMENTATION ////////////////////
+
+#ifdef OGL_BENCH_EGL
+
+inline bool HeadlessContext::create()
+{
+    auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay)
+        m_display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    if (m_display == EGL_NO_DISPLAY)
+        m_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+    EGLint major, minor;
+    if (m_display == EGL_NO_DISPLAY || !eglInitialize(m_display, &major, &minor))
+    {
+        std::cout << "ERROR::BENCH:: failed to initialize EGL display" << std::endl;
+        return false;
+    }
+    eglBindAPI(EGL_OPENGL_API);
+
+    // surfaceless contexts may not expose any config
+    const EGLint configAttribs[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+    EGLConfig config = EGL_NO_CONFIG_KHR;
+    EGLint numConfigs = 0;
+    if (!eglChooseConfig(m_display, configAttribs, &config, 1, &numConfigs) || numConfigs == 0)
+        config = EGL_NO_CONFIG_KHR;
+
+    const EGLint contextAttribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    m_context = eglCreateContext(m_display, config, EGL_NO_CONTEXT, contextAttribs);
+    if (m_context == EGL_NO_CONTEXT || !eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, m_context))
+    {
+        std::cout << "ERROR::BENCH:: failed to create surfaceless GL 3.3 context" << std::endl;
+        destroy();
+        return false;
+    }
+
+    if (!gladLoadGLLoader((GLADloadproc)eglGetProcAddress))
+    {
+        std::cout << "Failed to initialize GLAD" << std::endl;
+        destroy();
+        return false;
+    }
+    return true;
+}
+
+inline void HeadlessContext::destroy()
+{
+    if (m_display == EGL_NO_DISPLAY)
+        return;
+
+    eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (m_context != EGL_NO_CONTEXT)
+        eglDestroyContext(m_display, m_context);
+    eglTerminate(m_display);
+
+    m_context = EGL_NO_CONTEXT;
+    m_display = EGL_NO_DISPLAY;
+}
+
+#else
+
+inline bool HeadlessContext::create()
+{
+    glfwInit();
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+#ifdef __APPLE__
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+#endif
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
+    // the default framebuffer is never used, everything goes to the FBO
+    m_window = glfwCreateWindow(1, 1, "ogl", nullptr, nullptr);
+    if (!m_window)
+    {
+        std::cout << "Failed to create GLFW window" << std::endl;
+        glfwTerminate();
+        return false;
+    }
+    glfwMakeContextCurrent(m_window);
+
+    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+    {
+        std::cout << "Failed to initialize GLAD" << std::endl;
+        destroy();
+        return false;
+    }
+    return true;
+}
+
+inline void HeadlessContext::destroy()
+{
+    if (!m_window)
+        return;
+
+    glfwDestroyWindow(m_window);
+    glfwTerminate();
+    m_window = nullptr;
+}
+
+#endif
+
+inline bool Framebuffer::create(const unsigned int width, const unsigned int height)
+{
+    glGenFramebuffers(1, &m_fbo);
+    glGenRenderbuffers(1, &m_color);
+    glGenRenderbuffers(1, &m_depth);
+
+    glBindRenderbuffer(GL_RENDERBUFFER, m_color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_color);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, m_depth);
+
+    const bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (!complete)
+        std::cout << "ERROR::BENCH:: offscreen framebuffer is not complete" << std::endl;
+
+    return complete;
+}
+
+inline void Framebuffer::destroy()
+{
+    if (!m_fbo)
+        return;
+
+    glDeleteFramebuffers(1, &m_fbo);
+    glDeleteRenderbuffers(1, &m_color);
+    glDeleteRenderbuffers(1, &m_depth);
+    m_fbo = m_color = m_depth = 0;
+}
+
+inline void FrameTimer::begin()
+{
+    const unsigned int slot = m_frame % QUERY_RING;
+    // the slot is reused: its result from QUERY_RING frames ago has to be read first
+    if (m_pending[slot])
+        collect(slot);
+
+    m_cpuBegin = std::chrono::steady_clock::now();
+    glBeginQuery(GL_TIME_ELAPSED, m_queries[slot]);
+}
+
+inline void FrameTimer::end(const bool record)
+{
+    const unsigned int slot = m_frame % QUERY_RING;
+    glEndQuery(GL_TIME_ELAPSED);
+    // without swap buffers nothing forces the driver to submit
+    glFlush();
+
+    const auto cpuEnd = std::chrono::steady_clock::now();
+    if (record)
+        m_cpuMs.push_back(std::chrono::duration<double, std::milli>(cpuEnd - m_cpuBegin).count());
+
+    m_pending[slot] = true;
+    m_record[slot]  = record;
+    ++m_frame;
+}
+
+inline void FrameTimer::flush()
+{
+    // oldest first, so samples stay in frame order
+    for (unsigned int i = 0; i < QUERY_RING; ++i)
+    {
+        const unsigned int slot = (m_frame + i) % QUERY_RING;
+        if (m_pending[slot])
+            collect(slot);
+    }
+}
+
+inline void FrameTimer::collect(const unsigned int slot)
+{
+    GLuint64 elapsedNs = 0;
+    glGetQueryObjectui64v(m_queries[slot], GL_QUERY_RESULT, &elapsedNs);
+    if (m_record[slot])
+        m_gpuMs.push_back(elapsedNs / 1.0e6);
+    m_pending[slot] = false;
+}
+
+inline Stats summarize(std::vector<double> samples)
+{
+    Stats stats;
+    if (samples.empty())
+        return stats;
+
+    std::sort(samples.begin(), samples.end());
+
+    double sum = 0.0;
+    for (const double s : samples)
+        sum += s;
+    stats.mean = sum / samples.size();
+
+    // nearest rank
+    auto percentile = [&samples](const double p)
+    {
+        size_t rank = (size_t)std::ceil(p * samples.size());
+        rank = std::min(std::max(rank, (size_t)1), samples.size());
+        return samples[rank - 1];
+    };
+    stats.p50 = percentile(0.50);
+    stats.p99 = percentile(0.99);
+    return stats;
+}
+
+inline cam::Camera scriptedCamera(const Options& opt, const unsigned int frame)
+{
+    const float angle = 360.0f * frame / std::max(opt.frames, 1u);
+    const glm::vec3 position = opt.target + glm::vec3(opt.orbitRadius * std::cos(glm::radians(angle)),
+                                                      opt.orbitHeight,
+                                                      opt.orbitRadius * std::sin(glm::radians(angle)));
+
+    // look back at the target
+    const float yaw   = angle + 180.0f;
+    const float pitch = glm::degrees(std::atan2(opt.target.y - position.y, opt.orbitRadius));
+    return cam::Camera(position, glm::vec3(0.0f, 1.0f, 0.0f), yaw, pitch);
+}
+
+inline Report run(const Options& opt, const std::function<void(cam::Camera&)>& drawFrame)
+{
+    Report report;
+    report.width  = opt.width;
+    report.height = opt.height;
+    report.copies = opt.copies;
+    if (const GLubyte* renderer = glGetString(GL_RENDERER))
+        report.renderer = (const char*)renderer;
+
+    Framebuffer fbo;
+    if (!fbo.create(opt.width, opt.height))
+        return report;
+
+    fbo.bind();
+    glViewport(0, 0, opt.width, opt.height);
+    glEnable(GL_DEPTH_TEST);
+
+    FrameTimer timer;
+    for (unsigned int i = 0; i < opt.warmup + opt.frames; ++i)
+    {
+        const bool record = i >= opt.warmup;
+        cam::Camera camera = scriptedCamera(opt, record ? i - opt.warmup : 0);
+
+        timer.begin();
+        drawFrame(camera);
+        timer.end(record);
+    }
+    timer.flush();
+    glFinish();
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    report.cpuMs = timer.cpuMs();
+    report.gpuMs = timer.gpuMs();
+    return report;
+}
+
+inline void writeJson(std::ostream& os, const Report& report)
+{
+    auto writeStats = [&os](const char* name, const std::vector<double>& samples)
+    {
+        const Stats stats = summarize(samples);
+        os << "  \"" << name << "\": { \"mean\": " << stats.mean
+           << ", \"p50\": " << stats.p50
+           << ", \"p99\": " << stats.p99 << " }";
+    };
+
+    // renderer strings and file names are plain ASCII, only quotes and backslashes need escaping
+    auto escape = [](const std::string& str)
+    {
+        std::string escaped;
+        for (const char c : str)
+        {
+            if (c == '"' || c == '\\')
+                escaped += '\\';
+            escaped += c;
+        }
+        return escaped;
+    };
+
+    os << "{\n";
+    os << "  \"renderer\": \"" << escape(report.renderer) << "\",\n";
+    os << "  \"width\": " << report.width << ",\n";
+    os << "  \"height\": " << report.height << ",\n";
+    os << "  \"copies\": " << report.copies << ",\n";
+    os << "  \"frames\": " << report.cpuMs.size() << ",\n";
+    os << "  \"load_ms\": " << report.loadMs << ",\n";
+    writeStats("cpu_ms", report.cpuMs);
+    os << ",\n";
+    writeStats("gpu_ms", report.gpuMs);
+    os << ",\n";
+    if (!report.visibleMeshes.empty())
+    {
+        writeStats("visible_meshes", report.visibleMeshes);
+        os << ",\n";
+        writeStats("culled_meshes", report.culledMeshes);
+        os << ",\n";
+        writeStats("occluded_meshes", report.occludedMeshes);
+        os << ",\n";
+        writeStats("skipped_draws", report.skippedDraws);
+        os << ",\n";
+    }
+
+    os << "  \"textures\": [";
+    for (size_t i = 0; i < report.textures.size(); ++i)
+    {
+        const model::TextureTiming& t = report.textures[i];
+        os << (i ? ",\n" : "\n")
+           << "    { \"name\": \"" << escape(t.name) << "\""
+           << ", \"width\": " << t.width
+           << ", \"height\": " << t.height
+           << ", \"decode_ms\": " << t.decodeMs
+           << ", \"upload_ms\": " << t.uploadMs << " }";
+    }
+    os << (report.textures.empty() ? "]" : "\n  ]");
+    os << "\n}" << std::endl;
+}
+
+} // namespace bench
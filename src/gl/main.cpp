@@ -12,8 +12,21 @@
 #include "shaderManager/ShaderManager.h"
 #include "camera/camera.h"
 #include "model/model.h"
-
+#include "model/asyncModel.h"
+#include "model/textureCompressor.h"
+#include "bench/benchmark.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <memory>
 #include <string>
 
 namespace wind
@@ -101,7 +114,110 @@ GLFWwindow *init(const std::string name, const unsigned int width, const unsigne
     return window;
 }
 
-void render(GLFWwindow *window, ShaderManager &pShader, model::Model &pModel)
+// where drawScene places the model, above its root node
+glm::mat4 modelMatrix()
+{
+    glm::mat4 model = glm::mat4(1.0f);
+    model = glm::translate(model, glm::vec3(0.0f, -8.0f, 0.0f)); 
+    model = glm::scale(model, glm::vec3(1.0f, 1.0f, 1.0f));      
+    return model;
+}
+
+glm::mat4 projectionMatrix(cam::Camera &camera, const float aspect)
+{
+    return glm::perspective(glm::radians(camera.GetZoomLevel()), aspect, 0.1f, 100.0f);
+}
+
+// the model sets "model" per mesh, from its node
+void setTransforms(ShaderManager &pShader, cam::Camera &camera, const float aspect)
+{
+    {
+        // view
+        glm::mat4 view = camera.GetViewMatrix();
+        pShader.setMat4("view", view);
+
+        //projection transformations
+        glm::mat4 projection = projectionMatrix(camera, aspect);
+        pShader.setMat4("projection", projection);
+    }
+}
+
+// [count] places for --copies: a square grid in the ground plane around modelMatrix(), row by row
+std::vector<glm::mat4> copyGrid(const unsigned int count)
+{
+    const float spacing = 10.0f;
+    const unsigned int side = (unsigned int)std::ceil(std::sqrt((double)count));
+    const float half = (side - 1) * spacing * 0.5f;
+
+    std::vector<glm::mat4> copies;
+    copies.reserve(count);
+    for (unsigned int i = 0; i < count; ++i)
+        copies.push_back(glm::translate(glm::mat4(1.0f), glm::vec3((i % side) * spacing - half, 0.0f, (i / side) * spacing - half)) * modelMatrix());
+    return copies;
+}
+
+// pDepthShader: depth prepass over the position stream first, the color pass then shades every pixel once.
+// copies: draws the model once per matrix, see Model::DrawInstanced()
+template <typename ModelT>
+void drawScene(ShaderManager &pShader, ModelT &pModel, cam::Camera &camera, const unsigned int width, const unsigned int height,
+               ShaderManager *pDepthShader = nullptr, const std::vector<glm::mat4> *copies = nullptr)
+{
+    glClearColor(0.05f, 0.05f, 0.05f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    // meshes are culled in world space, meshlets in mesh space, levels of detail picked for a 1 pixel error
+    const float aspect = (float)width / (float)height;
+    pModel.setTransform(modelMatrix());
+    pModel.setView(model::WorldView::from(projectionMatrix(camera, aspect), camera.GetViewMatrix(), (float)height));
+
+    if (pDepthShader)
+    {
+        pDepthShader->use();
+        setTransforms(*pDepthShader, camera, aspect);
+
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        if (copies)
+            pModel.DrawDepthInstanced(*pDepthShader, *copies);
+        else
+            pModel.DrawDepth(*pDepthShader);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+        glDepthFunc(GL_LEQUAL);
+        glDepthMask(GL_FALSE);
+    }
+
+    pShader.use();
+    setTransforms(pShader, camera, aspect);
+
+    // draw
+    if (copies)
+        pModel.DrawInstanced(pShader, *copies);
+    else
+        pModel.Draw(pShader);
+
+    if (pDepthShader)
+    {
+        glDepthMask(GL_TRUE);
+        glDepthFunc(GL_LESS);
+    }
+}
+
+// the mesh under the cursor: a world space ray through wind::lastX / lastY
+template <typename ModelT>
+void pickScene(ModelT &pModel, cam::Camera &camera, const unsigned int width, const unsigned int height)
+{
+    const float aspect = (float)width / (float)height;
+    const model::Ray ray = model::Ray::fromScreen(wind::lastX, wind::lastY, (float)width, (float)height,
+                                                  projectionMatrix(camera, aspect), camera.GetViewMatrix());
+
+    model::PickHit hit;
+    if (pModel.pick(ray, hit))
+        std::cout << "pick: instance " << hit.instance << " of mesh " << hit.mesh << ", triangle " << hit.triangle << " at " << hit.distance << std::endl;
+    else
+        std::cout << "pick: nothing" << std::endl;
+}
+
+void render(GLFWwindow *window, ShaderManager &pShader, model::AsyncModel &pModel, ShaderManager *pDepthShader)
 {
     if (!window)
         return;
@@ -123,6 +239,8 @@ void render(GLFWwindow *window, ShaderManager &pShader, model::Model &pModel)
             wind::camera.ProcessKeyboard(cam::eRIGHT, wind::deltaTime);
     };
 
+    unsigned int shownVisible = ~0u, shownCulled = ~0u, shownOccluded = ~0u;
+    bool clicked = false;
     while (!glfwWindowShouldClose(window))
     {
         float currentFrame = glfwGetTime();
@@ -132,29 +250,39 @@ void render(GLFWwindow *window, ShaderManager &pShader, model::Model &pModel)
         // input
         processInput(window);
 
-        glClearColor(0.05f, 0.05f, 0.05f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        pShader.use();
+        // left click, once per press
+        const bool click = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS;
+        if (click && !clicked)
+            pickScene(pModel, wind::camera, wind::SCR_WIDTH, wind::SCR_HEIGHT);
+        clicked = click;
 
+        // upload whatever the loader finished, a few ms per frame
+        if (pModel.state() == model::AsyncModel::eLOADING)
         {
-            // model
-            glm::mat4 model = glm::mat4(1.0f);
-            model = glm::translate(model, glm::vec3(0.0f, -8.0f, 0.0f)); 
-            model = glm::scale(model, glm::vec3(1.0f, 1.0f, 1.0f));      
-            pShader.setMat4("model", model);
-
-            // view
-            glm::mat4 view = wind::camera.GetViewMatrix();
-            pShader.setMat4("view", view);
-
-            //projection transformations
-            glm::mat4 projection = glm::perspective(glm::radians(wind::camera.GetZoomLevel()), (float)wind::SCR_WIDTH / (float)wind::SCR_HEIGHT, 0.1f, 100.0f);
-            pShader.setMat4("projection", projection);
+            pModel.update();
+
+            const int percent = (int)(pModel.progress() * 100.0f);
+            glfwSetWindowTitle(window, ("ogl - loading " + std::to_string(percent) + "%").c_str());
+            if (pModel.state() == model::AsyncModel::eREADY)
+            {
+                glfwSetWindowTitle(window, "ogl");
+                model::TextureLoader::printTimings(std::cout, pModel.textureTimings());
+            }
         }
 
-        // draw
-        pModel.Draw(pShader);
+        drawScene(pShader, pModel, wind::camera, wind::SCR_WIDTH, wind::SCR_HEIGHT, pDepthShader);
+
+        // frustum and occlusion culling of this frame, the title only changes with the counts
+        const model::DrawStats &stats = pModel.drawStats();
+        if (pModel.state() == model::AsyncModel::eREADY &&
+            (stats.meshes != shownVisible || stats.meshesCulled != shownCulled || stats.meshesOccluded != shownOccluded))
+        {
+            shownVisible = stats.meshes;
+            shownCulled = stats.meshesCulled;
+            shownOccluded = stats.meshesOccluded;
+            glfwSetWindowTitle(window, ("ogl - " + std::to_string(shownVisible) + " visible / " + std::to_string(shownCulled) + " culled / " +
+                                        std::to_string(shownOccluded) + " occluded").c_str());
+        }
 
         glfwSwapBuffers(window);
         glfwPollEvents();
@@ -167,19 +295,208 @@ void destroy(GLFWwindow *window)
         glfwTerminate();
 }
 
-int main()
+// a whole decimal number, at least [min]
+bool parseCount(const char *text, const unsigned int min, unsigned int &value)
 {
-    auto window = init("ogl", wind::SCR_WIDTH, wind::SCR_HEIGHT);
+    char *end = nullptr;
+    errno = 0;
+    const unsigned long parsed = std::strtoul(text, &end, 10);
+    if (end == text || *end || errno == ERANGE || text[0] == '-' || parsed < min || parsed > UINT_MAX)
+    {
+        std::cout << "invalid count: " << text << std::endl;
+        return false;
+    }
+    value = (unsigned int)parsed;
+    return true;
+}
 
-    // build and compile shaders
-    const std::string path = "d:/CODE/ogl/src/gl/resources/"; // current dir
+// a finite decimal number, not negative
+bool parseEpsilon(const char *text, float &value)
+{
+    char *end = nullptr;
+    errno = 0;
+    const float parsed = std::strtof(text, &end);
+    if (end == text || *end || errno == ERANGE || !std::isfinite(parsed) || parsed < 0.0f)
+    {
+        std::cout << "invalid epsilon: " << text << std::endl;
+        return false;
+    }
+    value = parsed;
+    return true;
+}
 
-    ShaderManager ourShader((path + "shader/vertex.vs").c_str(), (path + "shader/fragment.fs").c_str());
+// --headless [--frames N] [--warmup N] [--size WxH] [--copies N] [--json file] [--resources dir]
+// --bake-textures model --dedup-textures
+// --weld-epsilon e --meshlets --lods N --packed-vertices --depth-prepass --shared-buffers --release-geometry
+// --occlusion --occlusion-queries --queries-per-frame N
+bool parseArgs(int argc, char **argv, bench::Options &opt, std::string &path, std::string &bake)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const char *arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+
+        if (std::strcmp(arg, "--headless") == 0)
+            opt.headless = true;
+        else if (std::strcmp(arg, "--frames") == 0 && hasValue)
+        {
+            if (!parseCount(argv[++i], 1, opt.frames))
+                return false;
+        }
+        else if (std::strcmp(arg, "--warmup") == 0 && hasValue)
+        {
+            if (!parseCount(argv[++i], 0, opt.warmup))
+                return false;
+        }
+        else if (std::strcmp(arg, "--size") == 0 && hasValue)
+        {
+            unsigned int w = 0, h = 0;
+            if (std::sscanf(argv[++i], "%ux%u", &w, &h) != 2 || !w || !h)
+                return false;
+            opt.width = w;
+            opt.height = h;
+        }
+        else if (std::strcmp(arg, "--json") == 0 && hasValue)
+            opt.jsonPath = argv[++i];
+        else if (std::strcmp(arg, "--copies") == 0 && hasValue)
+        {
+            if (!parseCount(argv[++i], 1, opt.copies))
+                return false;
+        }
+        else if (std::strcmp(arg, "--resources") == 0 && hasValue)
+            path = std::string(argv[++i]) + '/';
+        else if (std::strcmp(arg, "--bake-textures") == 0 && hasValue)
+            bake = argv[++i];
+        else if (std::strcmp(arg, "--dedup-textures") == 0)
+            model::TextureCache::instance().setContentDedup(true);
+        else if (std::strcmp(arg, "--weld-epsilon") == 0 && hasValue)
+        {
+            if (!parseEpsilon(argv[++i], model::Model::settings().weldEpsilon))
+                return false;
+        }
+        else if (std::strcmp(arg, "--meshlets") == 0)
+            model::Model::settings().meshlets = true;
+        else if (std::strcmp(arg, "--lods") == 0 && hasValue)
+        {
+            if (!parseCount(argv[++i], 0, model::Model::settings().lods))
+                return false;
+        }
+        else if (std::strcmp(arg, "--packed-vertices") == 0)
+            model::Mesh::uploadSettings().packVertices = true;
+        else if (std::strcmp(arg, "--depth-prepass") == 0)
+            model::Mesh::uploadSettings().positionStream = true;
+        else if (std::strcmp(arg, "--shared-buffers") == 0)
+            model::Mesh::uploadSettings().sharedBuffer = true;
+        else if (std::strcmp(arg, "--release-geometry") == 0)
+            model::Mesh::uploadSettings().keepGeometry = false;
+        else if (std::strcmp(arg, "--occlusion") == 0)
+            model::MeshCuller::settings().occlusion = true;
+        else if (std::strcmp(arg, "--occlusion-queries") == 0)
+            model::MeshCuller::settings().occlusionQueries = true;
+        else if (std::strcmp(arg, "--queries-per-frame") == 0 && hasValue)
+        {
+            if (!parseCount(argv[++i], 1, model::MeshCuller::settings().queriesPerFrame))
+                return false;
+        }
+        else
+        {
+            std::cout << "unknown argument: " << arg << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// the packed vertex layout needs its own decode
+std::string vertexShader(const std::string &path)
+{
+    return path + (model::Mesh::uploadSettings().packVertices ? "shader/packed.vs" : "shader/vertex.vs");
+}
+
+// --depth-prepass, reads the position stream only
+std::unique_ptr<ShaderManager> depthShader(const std::string &path)
+{
+    if (!model::Mesh::uploadSettings().positionStream)
+        return nullptr;
+    return std::make_unique<ShaderManager>(vertexShader(path).c_str(), (path + "shader/depth.fs").c_str());
+}
+
+int benchmark(const bench::Options &opt, const std::string &path)
+{
+    bench::HeadlessContext context;
+    if (!context.create())
+        return -1;
+
+    ShaderManager ourShader(vertexShader(path).c_str(), (path + "shader/fragment.fs").c_str());
+    // meshes only store what this program reads
+    model::Mesh::uploadSettings().attributes = ourShader.activeAttributes();
+    const std::unique_ptr<ShaderManager> ourDepthShader = depthShader(path);
+
+    const auto loadBegin = std::chrono::steady_clock::now();
     model::Model ourModel((path + "model/nanosuit/nanosuit.obj").c_str());
+    const auto loadEnd = std::chrono::steady_clock::now();
 
-    // draw in wireframe
-    //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-    render(window, ourShader, ourModel);
+    const std::vector<glm::mat4> copies = copyGrid(opt.copies);
+
+    std::vector<double> visible, culled, occluded, skipped;
+    bench::Report report = bench::run(opt, [&](cam::Camera &camera)
+    {
+        drawScene(ourShader, ourModel, camera, opt.width, opt.height, ourDepthShader.get(), opt.copies > 1 ? &copies : nullptr);
+        visible.push_back(ourModel.drawStats().meshes);
+        culled.push_back(ourModel.drawStats().meshesCulled);
+        occluded.push_back(ourModel.drawStats().meshesOccluded);
+        skipped.push_back(ourModel.drawStats().drawsSkipped);
+    });
+    // warmup frames are not part of the report
+    report.visibleMeshes.assign(visible.begin() + std::min<size_t>(opt.warmup, visible.size()), visible.end());
+    report.culledMeshes.assign(culled.begin() + std::min<size_t>(opt.warmup, culled.size()), culled.end());
+    report.occludedMeshes.assign(occluded.begin() + std::min<size_t>(opt.warmup, occluded.size()), occluded.end());
+    report.skippedDraws.assign(skipped.begin() + std::min<size_t>(opt.warmup, skipped.size()), skipped.end());
+    report.loadMs = std::chrono::duration<double, std::milli>(loadEnd - loadBegin).count();
+    report.textures = ourModel.textureTimings();
+
+    if (opt.jsonPath.empty())
+        bench::writeJson(std::cout, report);
+    else
+    {
+        std::ofstream os(opt.jsonPath);
+        bench::writeJson(os, report);
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    const std::string path = "d:/CODE/ogl/src/gl/resources/"; // current dir
+
+    bench::Options opt;
+    std::string resources = path;
+    std::string bake;
+    if (!parseArgs(argc, argv, opt, resources, bake))
+        return -1;
+
+    // offline, no context needed
+    if (!bake.empty())
+        return model::TextureCompressor::bakeModel(bake) > 0 ? 0 : -1;
+
+    if (opt.headless)
+        return benchmark(opt, resources);
+
+    auto window = init("ogl", wind::SCR_WIDTH, wind::SCR_HEIGHT);
+
+    // gl objects are released at the end of this scope, before the context goes
+    {
+        // build and compile shaders
+        ShaderManager ourShader(vertexShader(resources).c_str(), (resources + "shader/fragment.fs").c_str());
+        model::Mesh::uploadSettings().attributes = ourShader.activeAttributes();
+        const std::unique_ptr<ShaderManager> ourDepthShader = depthShader(resources);
+        // returns right away, the render loop uploads the model as it arrives
+        model::AsyncModel ourModel((resources + "model/nanosuit/nanosuit.obj").c_str());
+
+        // draw in wireframe
+        //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+        render(window, ourShader, ourModel, ourDepthShader.get());
+    }
 
     destroy(window);
     return 0;
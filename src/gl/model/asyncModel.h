@@ -0,0 +1,412 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include "model/mesh.h"
+#include "model/meshCache.h"
+#include "model/model.h"
+#include "model/sceneDraw.h"
+#include "model/texture.h"
+#include "model/textureCache.h"
+#include "shaderManager/ShaderManager.h"
+#include "util/threadPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+Asynchronous model:
+
+    The constructor returns right away, a worker thread does the cpu side of the load:
+    * mesh cache or Assimp import + processMesh
+    * texture decoding, each image is handed over as soon as it is decoded
+
+    update() runs on the context thread once per frame and uploads what is ready within a time budget.
+    A mesh draws as soon as its geometry is uploaded, textures that are not there yet are replaced by
+    TextureLoader::fallbackTexture(). With UploadSettings::sharedBuffer the model's buffer is allocated
+    at once and filled one range per step.
+
+    cancel() stops the worker at the next step (Assimp included), meshes uploaded so far stay drawable.
+*/
+
+namespace model
+{
+
+class AsyncModel
+{
+public:
+    enum eState
+    {
+        eLOADING = 0,
+        eREADY,
+        eFAILED,
+        eCANCELLED
+    };
+
+public:
+    explicit AsyncModel(const std::string& path);
+    AsyncModel(const AsyncModel&) = delete;
+    AsyncModel& operator=(const AsyncModel&) = delete;
+    // cancels, waits for the worker and releases the textures
+    ~AsyncModel();
+
+    // context thread, once per frame
+    void update(const double budgetMs = 4.0);
+    void Draw(ShaderManager& shader);
+    void DrawDepth(ShaderManager& shader);
+    // see Model::DrawInstanced(), meshes still loading are left out
+    void DrawInstanced(ShaderManager& shader, const glm::mat4* transforms, const size_t count);
+    void DrawInstanced(ShaderManager& shader, const std::vector<glm::mat4>& transforms) { DrawInstanced(shader, transforms.data(), transforms.size()); }
+    void DrawDepthInstanced(ShaderManager& shader, const glm::mat4* transforms, const size_t count);
+    void DrawDepthInstanced(ShaderManager& shader, const std::vector<glm::mat4>& transforms) { DrawDepthInstanced(shader, transforms.data(), transforms.size()); }
+
+    // see Model::setView()
+    void setView(const WorldView& view) { m_draw.setView(view); }
+    void clearView() { m_draw.clearView(); }
+    const DrawStats& drawStats() const { return m_draw.drawStats(); }
+    // see Model::setTransform(), the graph is there once the worker handed the scene over
+    void setTransform(const glm::mat4& transform) { m_draw.setTransform(transform); }
+    SceneGraph& graph() { return m_draw.graph(); }
+    // see Model::pick(), meshes still loading are not hit
+    bool pick(const Ray& ray, PickHit& hit);
+
+    void cancel();
+
+    eState state() const { return m_state; }
+    // [0, 1]: import 50%, mesh uploads 30%, texture uploads 20%
+    float progress() const;
+
+    const std::vector<TextureTiming>& textureTimings() const { return m_texTimings; }
+
+private:
+    struct DecodedImage
+    {
+        std::string name;
+        std::string path;
+        bool srgb = false;
+        Image image;        // empty if the path was already resident in TextureCache
+        double decodeMs = 0.0;
+    };
+
+    void worker(const std::string& path);
+    void takeScene();
+    void uploadImage(DecodedImage& decoded);
+
+private:
+    std::thread m_thread;
+    std::string m_directory;
+
+    // worker -> context thread
+    std::mutex m_mutex;
+    std::atomic<bool>  m_cancel{ false };
+    std::atomic<bool>  m_workerDone{ false };
+    std::atomic<bool>  m_sceneReady{ false };
+    std::atomic<float> m_importProgress{ 0.0f };
+    std::atomic<unsigned int> m_textureTotal{ 0 };
+    bool m_workerFailed = false;
+    SceneData m_pendingScene;
+    std::deque<DecodedImage> m_images;
+
+    // context thread only
+    eState m_state = eLOADING;
+    bool m_sceneTaken = false;
+    SceneData m_scene;
+    std::vector<std::vector<unsigned int>> m_meshNodes; // nodes referencing each scene mesh
+    std::vector<Mesh> m_meshes;       // uploaded scene meshes, in order
+    MeshBuffer m_buffer;              // UploadSettings::sharedBuffer only
+    std::vector<DrawRange> m_ranges;  // per scene mesh
+    SceneDraw m_draw;                 // instances of the uploaded meshes only
+    std::map<std::string, unsigned int> m_textureIds;
+    unsigned int m_texturesUploaded = 0;
+    std::vector<TextureTiming> m_texTimings;
+};
+
+//////////////////// IMPLEMENTATION ////////////////////
+
+inline AsyncModel::AsyncModel(const std::string& path)
+    : m_directory(path.substr(0, path.find_last_of('/')))
+{
+    stbi_set_flip_vertically_on_load(true);
+    TextureLoader::detectFormats();
+    m_thread = std::thread([this, path] { worker(path); });
+}
+
+inline AsyncModel::~AsyncModel()
+{
+    m_cancel = true;
+    if (m_thread.joinable())
+        m_thread.join();
+
+    for (const auto& texture : m_textureIds)
+        TextureCache::instance().release(texture.second);
+}
+
+inline void AsyncModel::cancel()
+{
+    m_cancel = true;
+    if (m_state == eLOADING)
+        m_state = eCANCELLED;
+}
+
+inline float AsyncModel::progress() const
+{
+    if (m_state == eREADY)
+        return 1.0f;
+
+    float progress = 0.5f * m_importProgress;
+    if (!m_meshNodes.empty())
+        progress += 0.3f * m_meshes.size() / m_meshNodes.size();
+
+    const unsigned int textures = m_textureTotal;
+    if (m_workerDone && textures == 0)
+        progress += 0.2f;
+    else if (textures)
+        progress += 0.2f * m_texturesUploaded / textures;
+
+    return progress;
+}
+
+inline void AsyncModel::worker(const std::string& path)
+{
+    SceneData scene;
+
+    uint64_t key = 0;
+    const std::string cachePath = path + ".meshcache";
+    const bool cacheable = Model::cacheKey(path, key);
+
+    bool loaded = cacheable && cache::read(cachePath, key, scene.meshes, scene.nodes);
+    if (!loaded)
+    {
+        loaded = Model::importScene(path, scene, [this](const float percentage)
+        {
+            m_importProgress = percentage;
+            return !m_cancel;
+        });
+        if (loaded && cacheable && !m_cancel)
+            cache::write(cachePath, key, scene.meshes, scene.nodes);
+    }
+    m_importProgress = 1.0f;
+
+    if (!loaded || m_cancel)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_workerFailed = !loaded && !m_cancel; // an aborted import is not a failure
+        m_workerDone = true;
+        return;
+    }
+
+    // every texture name once, the first use decides the color space
+    std::vector<std::string> names;
+    std::vector<bool> srgb;
+    for (const MeshData& mesh : scene.meshes)
+    {
+        for (const Texture& texture : mesh.textures)
+        {
+            if (std::find(names.begin(), names.end(), texture.name) == names.end())
+            {
+                names.push_back(texture.name);
+                srgb.push_back(TextureLoader::srgb(texture.type));
+            }
+        }
+    }
+
+    // hand the geometry over before decoding anything
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pendingScene = std::move(scene);
+        m_textureTotal = (unsigned int)names.size();
+        m_sceneReady = true;
+    }
+
+    util::defaultPool().parallelFor(names.size(), [&](const size_t i)
+    {
+        if (m_cancel)
+            return;
+
+        DecodedImage decoded;
+        decoded.name = names[i];
+        decoded.path = TextureCache::resolve(m_directory, names[i]);
+        decoded.srgb = srgb[i];
+
+        // another model may have it already, no need to decode
+        if (!TextureCache::instance().contains(decoded.path))
+        {
+            const auto begin = std::chrono::steady_clock::now();
+            decoded.image = TextureLoader::decode(decoded.path, decoded.srgb);
+            decoded.decodeMs = elapsedMs(begin);
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_images.push_back(std::move(decoded));
+    });
+
+    m_workerDone = true;
+}
+
+inline void AsyncModel::takeScene()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_scene = std::move(m_pendingScene);
+    }
+    m_sceneTaken = true;
+
+    // one Mesh per scene mesh, its node references become instances once it is uploaded
+    m_meshNodes.resize(m_scene.meshes.size());
+    for (const cache::Node& node : m_scene.nodes)
+    {
+        const unsigned int added = m_draw.graph().add(node.parent, node.transform);
+        for (const unsigned int mesh : node.meshes)
+            m_meshNodes[mesh].push_back(added);
+    }
+    m_meshes.reserve(m_scene.meshes.size());
+
+    const UploadSettings& upload = Mesh::uploadSettings();
+    if (upload.sharedBuffer && !m_scene.meshes.empty())
+    {
+        std::vector<MeshSource> sources;
+        for (const MeshData& mesh : m_scene.meshes)
+            sources.push_back(mesh.source()); // sizes only until upload()
+        m_buffer.allocate(sources, upload.attributes, upload.packVertices, upload.positionStream, m_ranges);
+    }
+}
+
+inline void AsyncModel::update(const double budgetMs)
+{
+    if (m_state != eLOADING)
+        return;
+
+    const auto begin = std::chrono::steady_clock::now();
+
+    if (!m_sceneTaken)
+    {
+        if (m_sceneReady)
+            takeScene();
+        else if (m_workerDone)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_state = m_workerFailed ? eFAILED : eCANCELLED;
+            return;
+        }
+        else
+            return;
+    }
+
+    // geometry first: every uploaded mesh can be drawn right away
+    while (m_meshes.size() < m_meshNodes.size() && elapsedMs(begin) < budgetMs)
+    {
+        const unsigned int index = (unsigned int)m_meshes.size();
+        MeshData& mesh = m_scene.meshes[index];
+
+        std::vector<Texture> textures = mesh.textures;
+        for (Texture& texture : textures)
+        {
+            auto found = m_textureIds.find(texture.name);
+            texture.id = found != m_textureIds.end() ? found->second : TextureLoader::fallbackTexture();
+        }
+        if (m_buffer.empty())
+            Model::emplaceMesh(m_meshes, mesh, std::move(textures));
+        else
+        {
+            m_buffer.upload(mesh.source(), m_ranges[index]);
+            m_meshes.emplace_back(m_buffer, m_ranges[index], std::move(textures));
+            m_meshes.back().m_detail = mesh.detail;
+            m_meshes.back().keepBaseLevel(mesh.source());
+        }
+        for (const unsigned int node : m_meshNodes[index])
+            m_draw.add(index, node);
+    }
+
+    // then textures, one at a time
+    while (elapsedMs(begin) < budgetMs)
+    {
+        DecodedImage decoded;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_images.empty())
+                break;
+            decoded = std::move(m_images.front());
+            m_images.pop_front();
+        }
+        uploadImage(decoded);
+    }
+
+    if (m_meshes.size() == m_meshNodes.size() && m_texturesUploaded == m_textureTotal && m_workerDone)
+    {
+        // what the meshes did not take
+        m_scene = SceneData();
+        m_state = eREADY;
+    }
+}
+
+inline void AsyncModel::uploadImage(DecodedImage& decoded)
+{
+    const auto begin = std::chrono::steady_clock::now();
+
+    TextureCache& cache = TextureCache::instance();
+    unsigned int id;
+    if (!decoded.image.empty())
+        id = cache.acquire(decoded.path, decoded.image);
+    else
+    {
+        // resident when the worker looked, decoded here if released since
+        const std::vector<bool> srgb = { decoded.srgb };
+        id = cache.acquire({ decoded.path }, nullptr, &srgb)[0];
+    }
+
+    TextureTiming timing;
+    timing.name       = decoded.name;
+    timing.width      = decoded.image.width;
+    timing.height     = decoded.image.height;
+    timing.components = decoded.image.components;
+    timing.decodeMs   = decoded.decodeMs;
+    timing.uploadMs   = elapsedMs(begin);
+    m_texTimings.push_back(timing);
+
+    m_textureIds[decoded.name] = id;
+    ++m_texturesUploaded;
+
+    // swap the placeholder in every mesh already uploaded, later meshes pick it up from m_textureIds
+    for (Mesh& mesh : m_meshes)
+    {
+        for (Texture& texture : mesh.m_textures)
+        {
+            if (texture.name == decoded.name)
+                texture.id = id;
+        }
+    }
+}
+
+inline void AsyncModel::Draw(ShaderManager& shader)
+{
+    m_draw.Draw(shader, m_meshes, m_buffer);
+}
+
+inline void AsyncModel::DrawDepth(ShaderManager& shader)
+{
+    m_draw.DrawDepth(shader, m_meshes, m_buffer);
+}
+
+inline void AsyncModel::DrawInstanced(ShaderManager& shader, const glm::mat4* transforms, const size_t count)
+{
+    m_draw.DrawInstanced(shader, m_meshes, m_buffer, transforms, count);
+}
+
+inline void AsyncModel::DrawDepthInstanced(ShaderManager& shader, const glm::mat4* transforms, const size_t count)
+{
+    m_draw.DrawDepthInstanced(shader, m_meshes, m_buffer, transforms, count);
+}
+
+inline bool AsyncModel::pick(const Ray& ray, PickHit& hit)
+{
+    return m_draw.pick(m_meshes, ray, hit);
+}
+
+} // namespace model
@@ -0,0 +1,418 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "model/vertexFormat.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define OGL_BOUNDS_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define OGL_BOUNDS_SSE2
+#endif
+
+/*
+Bounding volumes and the view they are culled against:
+
+    * Frustum: the 6 planes of a clip matrix (Gribb / Hartmann), normalized, pointing inwards
+    * WorldView: the camera in world space, CullView for one mesh from it
+    * CullView: frustum and eye of one draw in the space of the geometry, so bounds computed at import
+      are tested as they are: planes of projection * view * model, eye = inverse(view * model) * origin.
+      lodScale turns a mesh space error at distance d into pixels: error * lodScale / d, divided by the
+      pixel budget so a level fits when that is <= 1
+    * BoxSet: boxes in structure of arrays form, culled 8 per iteration: per plane the corner farthest along
+      the normal is picked by the sign of the normal (the same for every box), one multiply add per axis
+      and a compare give 8 outside bits. AVX when the compiler targets it, two SSE2 halves otherwise,
+      scalar on other architectures
+    * Ray: origin and direction, slab test against boxes and Moller-Trumbore against triangles (both faces).
+      fromScreen unprojects a cursor position through inverse(projection * view); transformed keeps the
+      direction unnormalized, so distances along a mesh space ray are those of the world space one
+*/
+
+namespace model
+{
+
+struct Aabb
+{
+    glm::vec3 min = glm::vec3(0.0f);
+    glm::vec3 max = glm::vec3(0.0f);
+
+    static Aabb around(const Vertex* vertices, const size_t count);
+    // the box around the transformed box (Arvo)
+    Aabb transformed(const glm::mat4& matrix) const;
+};
+
+struct Sphere
+{
+    glm::vec3 center = glm::vec3(0.0f);
+    float     radius = 0.0f;
+
+    // center of the box, radius to the farthest vertex
+    static Sphere around(const Vertex* vertices, const size_t count);
+};
+
+class Frustum
+{
+public:
+    enum ePlane
+    {
+        eLEFT = 0,
+        eRIGHT,
+        eBOTTOM,
+        eTOP,
+        eNEAR,
+        eFAR,
+        ePLANE_COUNT
+    };
+
+    static Frustum fromMatrix(const glm::mat4& clip);
+
+    // false only if the sphere is entirely outside one plane
+    bool intersects(const Sphere& sphere) const;
+    bool intersects(const Aabb& box) const;
+
+    // xyz = normal, w = distance: dot(normal, p) + w >= 0 inside
+    glm::vec4 planes[ePLANE_COUNT];
+};
+
+struct CullView
+{
+    Frustum   frustum;
+    glm::vec3 eye = glm::vec3(0.0f);
+    float     lodScale = 0.0f; // 0: no LOD selection, always the full mesh
+
+    // viewportHeight 0 leaves lodScale at 0. pixelError: projected error a LOD may have
+    static CullView from(const glm::mat4& projection, const glm::mat4& view, const glm::mat4& model,
+                         const float viewportHeight = 0.0f, const float pixelError = 1.0f);
+};
+
+struct Ray
+{
+    glm::vec3 origin = glm::vec3(0.0f);
+    glm::vec3 direction = glm::vec3(0.0f, 0.0f, -1.0f);
+    glm::vec3 inverse = glm::vec3(0.0f, 0.0f, -1.0f); // 1 / direction, for the slab test
+
+    static Ray make(const glm::vec3& origin, const glm::vec3& direction);
+    // through the cursor at (x, y) in a width x height window, y down as GLFW reports it
+    static Ray fromScreen(const float x, const float y, const float width, const float height,
+                          const glm::mat4& projection, const glm::mat4& view);
+    Ray transformed(const glm::mat4& matrix) const;
+
+    // tEntry: where the ray enters the box, 0 if it starts inside. False beyond tMax
+    bool intersects(const Aabb& box, const float tMax, float& tEntry) const;
+    // t: distance to the triangle, either face
+    bool intersects(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, float& t) const;
+};
+
+// camera of a draw in world space: whole meshes are culled against frustum, meshlets and levels of detail
+// against local(), the same view in the space of a mesh placed by [model]
+struct WorldView
+{
+    glm::mat4 projection = glm::mat4(1.0f);
+    glm::mat4 view = glm::mat4(1.0f);
+    float     viewportHeight = 0.0f; // see CullView::from()
+    Frustum   frustum;
+
+    static WorldView from(const glm::mat4& projection, const glm::mat4& view, const float viewportHeight = 0.0f);
+    CullView local(const glm::mat4& model) const { return CullView::from(projection, view, model, viewportHeight); }
+};
+
+class BoxSet
+{
+public:
+    static const unsigned int BATCH = 8;
+
+    void clear();
+    void add(const Aabb& box);
+    size_t size() const { return m_count; }
+
+    // visible[i]: box i is at least partly inside [frustum], size() entries. Returns how many are
+    size_t cull(const Frustum& frustum, unsigned char* visible) const;
+    // boxes [begin, end) only, visible[0] is box begin
+    size_t cull(const Frustum& frustum, unsigned char* visible, const size_t begin, const size_t end) const;
+
+private:
+    // min x, y, z then max x, y, z, padded with BATCH boxes outside every plane so a batch may start at any box
+    std::vector<float> m_lanes[6];
+    size_t m_count = 0;
+};
+
+//////////////////// IMPLEMENTATION ////////////////////
+
+inline Aabb Aabb::around(const Vertex* vertices, const size_t count)
+{
+    Aabb box;
+    if (count == 0)
+        return box;
+
+    box.min = box.max = vertices[0].Position;
+    for (size_t i = 1; i < count; ++i)
+    {
+        box.min = glm::min(box.min, vertices[i].Position);
+        box.max = glm::max(box.max, vertices[i].Position);
+    }
+    return box;
+}
+
+inline Aabb Aabb::transformed(const glm::mat4& matrix) const
+{
+    // per output axis the smaller / larger of each column's contribution
+    Aabb box;
+    box.min = box.max = glm::vec3(matrix[3]);
+    for (int column = 0; column < 3; ++column)
+    {
+        const glm::vec3 a = glm::vec3(matrix[column]) * min[column];
+        const glm::vec3 b = glm::vec3(matrix[column]) * max[column];
+        box.min += glm::min(a, b);
+        box.max += glm::max(a, b);
+    }
+    return box;
+}
+
+inline Sphere Sphere::around(const Vertex* vertices, const size_t count)
+{
+    Sphere sphere;
+    if (count == 0)
+        return sphere;
+
+    const Aabb box = Aabb::around(vertices, count);
+    sphere.center = (box.min + box.max) * 0.5f;
+
+    float radius2 = 0.0f;
+    for (size_t i = 0; i < count; ++i)
+    {
+        const glm::vec3 d = vertices[i].Position - sphere.center;
+        radius2 = std::max(radius2, glm::dot(d, d));
+    }
+    sphere.radius = std::sqrt(radius2);
+    return sphere;
+}
+
+inline Frustum Frustum::fromMatrix(const glm::mat4& clip)
+{
+    // rows of the matrix, glm is column major
+    const glm::mat4 m = glm::transpose(clip);
+
+    Frustum frustum;
+    frustum.planes[eLEFT]   = m[3] + m[0];
+    frustum.planes[eRIGHT]  = m[3] - m[0];
+    frustum.planes[eBOTTOM] = m[3] + m[1];
+    frustum.planes[eTOP]    = m[3] - m[1];
+    frustum.planes[eNEAR]   = m[3] + m[2];
+    frustum.planes[eFAR]    = m[3] - m[2];
+    for (glm::vec4& plane : frustum.planes)
+        plane /= glm::length(glm::vec3(plane));
+    return frustum;
+}
+
+inline bool Frustum::intersects(const Sphere& sphere) const
+{
+    for (const glm::vec4& plane : planes)
+    {
+        if (glm::dot(glm::vec3(plane), sphere.center) + plane.w < -sphere.radius)
+            return false;
+    }
+    return true;
+}
+
+inline bool Frustum::intersects(const Aabb& box) const
+{
+    for (const glm::vec4& plane : planes)
+    {
+        // the corner farthest along the normal
+        const glm::vec3 corner(plane.x > 0.0f ? box.max.x : box.min.x,
+                               plane.y > 0.0f ? box.max.y : box.min.y,
+                               plane.z > 0.0f ? box.max.z : box.min.z);
+        if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f)
+            return false;
+    }
+    return true;
+}
+
+inline CullView CullView::from(const glm::mat4& projection, const glm::mat4& view, const glm::mat4& model,
+                               const float viewportHeight, const float pixelError)
+{
+    const glm::mat4 modelView = view * model;
+
+    CullView cull;
+    cull.frustum = Frustum::fromMatrix(projection * modelView);
+    cull.eye = glm::vec3(glm::inverse(modelView)[3]);
+    // projection[1][1] = 1 / tan(fovy / 2): half the viewport spans tan(fovy / 2) * d at distance d
+    if (viewportHeight > 0.0f && pixelError > 0.0f)
+        cull.lodScale = viewportHeight * 0.5f * projection[1][1] / pixelError;
+    return cull;
+}
+
+inline WorldView WorldView::from(const glm::mat4& projection, const glm::mat4& view, const float viewportHeight)
+{
+    WorldView world;
+    world.projection = projection;
+    world.view = view;
+    world.viewportHeight = viewportHeight;
+    world.frustum = Frustum::fromMatrix(projection * view);
+    return world;
+}
+
+inline Ray Ray::make(const glm::vec3& origin, const glm::vec3& direction)
+{
+    Ray ray;
+    ray.origin = origin;
+    ray.direction = direction;
+    // a zero component gives a huge reciprocal rather than infinity, 0 * it stays finite
+    for (int axis = 0; axis < 3; ++axis)
+        ray.inverse[axis] = 1.0f / (std::abs(direction[axis]) > 1e-20f ? direction[axis] : std::copysign(1e-20f, direction[axis]));
+    return ray;
+}
+
+inline Ray Ray::fromScreen(const float x, const float y, const float width, const float height,
+                           const glm::mat4& projection, const glm::mat4& view)
+{
+    const glm::mat4 unproject = glm::inverse(projection * view);
+    const glm::vec2 ndc(2.0f * x / width - 1.0f, 1.0f - 2.0f * y / height);
+    glm::vec4 nearPoint = unproject * glm::vec4(ndc, -1.0f, 1.0f);
+    glm::vec4 farPoint = unproject * glm::vec4(ndc, 1.0f, 1.0f);
+    nearPoint /= nearPoint.w;
+    farPoint /= farPoint.w;
+    return make(glm::vec3(nearPoint), glm::normalize(glm::vec3(farPoint - nearPoint)));
+}
+
+inline Ray Ray::transformed(const glm::mat4& matrix) const
+{
+    return make(glm::vec3(matrix * glm::vec4(origin, 1.0f)), glm::vec3(matrix * glm::vec4(direction, 0.0f)));
+}
+
+inline bool Ray::intersects(const Aabb& box, const float tMax, float& tEntry) const
+{
+    const glm::vec3 t0 = (box.min - origin) * inverse;
+    const glm::vec3 t1 = (box.max - origin) * inverse;
+    const glm::vec3 tNear = glm::min(t0, t1);
+    const glm::vec3 tFar = glm::max(t0, t1);
+    tEntry = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+    const float tExit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, tMax));
+    return tEntry <= tExit;
+}
+
+inline bool Ray::intersects(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, float& t) const
+{
+    const glm::vec3 ab = b - a;
+    const glm::vec3 ac = c - a;
+    const glm::vec3 p = glm::cross(direction, ac);
+    const float determinant = glm::dot(ab, p);
+    if (std::abs(determinant) < 1e-12f)
+        return false;
+
+    const float inverseDeterminant = 1.0f / determinant;
+    const glm::vec3 s = origin - a;
+    const float u = glm::dot(s, p) * inverseDeterminant;
+    if (u < 0.0f || u > 1.0f)
+        return false;
+    const glm::vec3 q = glm::cross(s, ab);
+    const float v = glm::dot(direction, q) * inverseDeterminant;
+    if (v < 0.0f || u + v > 1.0f)
+        return false;
+    t = glm::dot(ac, q) * inverseDeterminant;
+    return t >= 0.0f;
+}
+
+inline void BoxSet::clear()
+{
+    for (std::vector<float>& lane : m_lanes)
+        lane.clear();
+    m_count = 0;
+}
+
+inline void BoxSet::add(const Aabb& box)
+{
+    // FLT_MAX rather than infinity: a zero normal component times it stays 0
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        m_lanes[axis].resize(m_count + 1 + BATCH, FLT_MAX);
+        m_lanes[axis + 3].resize(m_count + 1 + BATCH, -FLT_MAX);
+    }
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        m_lanes[axis][m_count] = box.min[axis];
+        m_lanes[axis + 3][m_count] = box.max[axis];
+    }
+    ++m_count;
+}
+
+inline size_t BoxSet::cull(const Frustum& frustum, unsigned char* visible) const
+{
+    return cull(frustum, visible, 0, m_count);
+}
+
+inline size_t BoxSet::cull(const Frustum& frustum, unsigned char* visible, const size_t begin, const size_t end) const
+{
+    // per plane: the lanes of the farthest corner and the broadcast plane
+    const float* corner[Frustum::ePLANE_COUNT][3];
+    for (int p = 0; p < Frustum::ePLANE_COUNT; ++p)
+        for (int axis = 0; axis < 3; ++axis)
+            corner[p][axis] = m_lanes[frustum.planes[p][axis] > 0.0f ? axis + 3 : axis].data();
+
+#if defined(OGL_BOUNDS_AVX)
+    __m256 normal[Frustum::ePLANE_COUNT][3], distance[Frustum::ePLANE_COUNT];
+    for (int p = 0; p < Frustum::ePLANE_COUNT; ++p)
+    {
+        for (int axis = 0; axis < 3; ++axis)
+            normal[p][axis] = _mm256_set1_ps(frustum.planes[p][axis]);
+        distance[p] = _mm256_set1_ps(-frustum.planes[p].w);
+    }
+#elif defined(OGL_BOUNDS_SSE2)
+    __m128 normal[Frustum::ePLANE_COUNT][3], distance[Frustum::ePLANE_COUNT];
+    for (int p = 0; p < Frustum::ePLANE_COUNT; ++p)
+    {
+        for (int axis = 0; axis < 3; ++axis)
+            normal[p][axis] = _mm_set1_ps(frustum.planes[p][axis]);
+        distance[p] = _mm_set1_ps(-frustum.planes[p].w);
+    }
+#endif
+
+    size_t count = 0;
+    for (size_t base = begin; base < end; base += BATCH)
+    {
+        // bit k: box base + k is outside a plane
+        unsigned int outside = 0;
+        for (int p = 0; p < Frustum::ePLANE_COUNT && outside != 0xFF; ++p)
+        {
+#if defined(OGL_BOUNDS_AVX)
+            __m256 d = _mm256_mul_ps(normal[p][0], _mm256_loadu_ps(corner[p][0] + base));
+            d = _mm256_add_ps(d, _mm256_mul_ps(normal[p][1], _mm256_loadu_ps(corner[p][1] + base)));
+            d = _mm256_add_ps(d, _mm256_mul_ps(normal[p][2], _mm256_loadu_ps(corner[p][2] + base)));
+            outside |= (unsigned int)_mm256_movemask_ps(_mm256_cmp_ps(d, distance[p], _CMP_LT_OQ));
+#elif defined(OGL_BOUNDS_SSE2)
+            for (unsigned int half = 0; half < BATCH; half += 4)
+            {
+                __m128 d = _mm_mul_ps(normal[p][0], _mm_loadu_ps(corner[p][0] + base + half));
+                d = _mm_add_ps(d, _mm_mul_ps(normal[p][1], _mm_loadu_ps(corner[p][1] + base + half)));
+                d = _mm_add_ps(d, _mm_mul_ps(normal[p][2], _mm_loadu_ps(corner[p][2] + base + half)));
+                outside |= (unsigned int)_mm_movemask_ps(_mm_cmplt_ps(d, distance[p])) << half;
+            }
+#else
+            const glm::vec4& plane = frustum.planes[p];
+            for (unsigned int k = 0; k < BATCH; ++k)
+            {
+                const size_t i = base + k;
+                if (plane.x * corner[p][0][i] + plane.y * corner[p][1][i] + plane.z * corner[p][2][i] < -plane.w)
+                    outside |= 1u << k;
+            }
+#endif
+        }
+
+        const size_t last = std::min(base + BATCH, end);
+        for (size_t i = base; i < last; ++i)
+        {
+            visible[i - begin] = (outside >> (i - base) & 1u) == 0;
+            count += visible[i - begin];
+        }
+    }
+    return count;
+}
+
+} // namespace model
@@ -0,0 +1,368 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "model/bounds.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cstdint>
+#include <vector>
+
+/*
+Bounding volume hierarchy over boxes (meshes of a model, triangles of a mesh):
+
+    * build: top down, binned surface area heuristic (16 bins on the centroids along each axis). A node
+      becomes a leaf when splitting costs more than testing its items, and always at 1 item
+    * layout: one array of 32 byte nodes in depth first order, the first child of an inner node follows it,
+      the second is at Node::index. Leaves refer to a contiguous run of items()
+    * refit: the boxes moved but the tree is kept, bounds are recomputed bottom up (children come after
+      their parent, so a reverse walk sees them first). Quality drops with large motion, rebuild then
+    * cull: planes a node is fully inside are not tested below it, a node inside every plane reports all
+      its leaves at once
+    * raycast: nearer child first, nodes entered beyond the closest hit so far are skipped
+*/
+
+namespace model
+{
+
+class Bvh
+{
+public:
+    static const unsigned int MAX_LEAF = 8;
+
+    struct Node
+    {
+        glm::vec3 min;
+        uint32_t  index; // inner: second child, leaf: first item
+        glm::vec3 max;
+        uint32_t  count; // 0 for inner nodes
+    };
+
+    void build(const std::vector<Aabb>& boxes, const unsigned int maxLeaf = MAX_LEAF);
+    // same boxes, new bounds
+    void refit(const std::vector<Aabb>& boxes);
+    void clear();
+
+    bool empty() const { return m_nodes.empty(); }
+    const std::vector<Node>& nodes() const { return m_nodes; }
+    // box indices in leaf order
+    const std::vector<unsigned int>& items() const { return m_items; }
+
+    // visit(first, count, inside) for every leaf that may be visible, [first, first + count) into items().
+    // inside: the whole leaf is, its boxes need no test
+    template <typename Visit>
+    void cull(const Frustum& frustum, Visit&& visit) const;
+
+    // hit(item, tMax) returns the distance of a hit on item closer than tMax, tMax otherwise.
+    // Returns the closest distance found, tMax if none
+    template <typename Hit>
+    float raycast(const Ray& ray, float tMax, Hit&& hit) const;
+
+private:
+    struct Build
+    {
+        std::vector<Aabb>      boxes;
+        std::vector<glm::vec3> centroids;
+        unsigned int           maxLeaf;
+    };
+    // below it splits are by index, so the depth stays under STACK for 2^32 items
+    enum { MAX_SAH_DEPTH = 28, STACK = 64 };
+
+    void split(Build& build, const unsigned int first, const unsigned int count, const unsigned int depth);
+    static float area(const Aabb& box);
+    static void grow(Aabb& box, const Aabb& other);
+
+private:
+    std::vector<Node>         m_nodes;
+    std::vector<unsigned int> m_items;
+};
+
+//////////////////// IMPLEMENTATION ////////////////////
+
+inline float Bvh::area(const Aabb& box)
+{
+    const glm::vec3 d = glm::max(box.max - box.min, glm::vec3(0.0f));
+    return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+
+inline void Bvh::grow(Aabb& box, const Aabb& other)
+{
+    box.min = glm::min(box.min, other.min);
+    box.max = glm::max(box.max, other.max);
+}
+
+inline void Bvh::clear()
+{
+    m_nodes.clear();
+    m_items.clear();
+}
+
+inline void Bvh::build(const std::vector<Aabb>& boxes, const unsigned int maxLeaf)
+{
+    clear();
+    if (boxes.empty())
+        return;
+
+    Build build;
+    build.boxes = boxes;
+    build.maxLeaf = std::max(maxLeaf, 1u);
+    build.centroids.resize(boxes.size());
+    for (size_t i = 0; i < boxes.size(); ++i)
+        build.centroids[i] = (boxes[i].min + boxes[i].max) * 0.5f;
+
+    m_items.resize(boxes.size());
+    for (unsigned int i = 0; i < m_items.size(); ++i)
+        m_items[i] = i;
+    m_nodes.reserve(boxes.size() * 2);
+    split(build, 0, (unsigned int)boxes.size(), 0);
+}
+
+inline void Bvh::split(Build& build, const unsigned int first, const unsigned int count, const unsigned int depth)
+{
+    const unsigned int self = (unsigned int)m_nodes.size();
+    m_nodes.push_back(Node());
+
+    Aabb bounds = build.boxes[m_items[first]];
+    glm::vec3 lo = build.centroids[m_items[first]], hi = lo;
+    for (unsigned int i = first; i < first + count; ++i)
+    {
+        grow(bounds, build.boxes[m_items[i]]);
+        lo = glm::min(lo, build.centroids[m_items[i]]);
+        hi = glm::max(hi, build.centroids[m_items[i]]);
+    }
+    m_nodes[self].min = bounds.min;
+    m_nodes[self].max = bounds.max;
+
+    // cheapest binned split over the three axes, cost in units of one box test
+    const int BINS = 16;
+    int bestAxis = -1, bestBin = 0;
+    float bestCost = FLT_MAX;
+    if (count > 1)
+    {
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            const float extent = hi[axis] - lo[axis];
+            if (extent <= 0.0f)
+                continue;
+
+            Aabb binBox[BINS];
+            unsigned int binCount[BINS] = {};
+            const float scale = BINS / extent;
+            for (unsigned int i = first; i < first + count; ++i)
+            {
+                const unsigned int item = m_items[i];
+                const int bin = std::min(BINS - 1, (int)((build.centroids[item][axis] - lo[axis]) * scale));
+                if (binCount[bin]++ == 0)
+                    binBox[bin] = build.boxes[item];
+                else
+                    grow(binBox[bin], build.boxes[item]);
+            }
+
+            // right to left sweep first, then left to right
+            float rightArea[BINS];
+            unsigned int rightCount[BINS];
+            Aabb right;
+            unsigned int n = 0;
+            for (int b = BINS - 1; b > 0; --b)
+            {
+                if (binCount[b])
+                {
+                    if (n == 0)
+                        right = binBox[b];
+                    grow(right, binBox[b]);
+                }
+                n += binCount[b];
+                rightCount[b] = n;
+                rightArea[b] = n ? area(right) : 0.0f;
+            }
+            Aabb left;
+            n = 0;
+            for (int b = 0; b < BINS - 1; ++b)
+            {
+                if (binCount[b])
+                {
+                    if (n == 0)
+                        left = binBox[b];
+                    grow(left, binBox[b]);
+                }
+                n += binCount[b];
+                if (n == 0 || rightCount[b + 1] == 0)
+                    continue;
+                const float cost = n * area(left) + rightCount[b + 1] * rightArea[b + 1];
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestBin = b;
+                }
+            }
+        }
+    }
+
+    // traversal costs about one box test per child
+    const float parentArea = area(bounds);
+    if (count <= build.maxLeaf && (bestAxis < 0 || (float)count * parentArea <= bestCost + 2.0f * parentArea))
+    {
+        m_nodes[self].index = first;
+        m_nodes[self].count = count;
+        return;
+    }
+
+    // every centroid in one spot, or deep enough to risk the traversal stacks: halves by index
+    unsigned int middle = first + count / 2;
+    if (bestAxis >= 0 && depth < MAX_SAH_DEPTH)
+    {
+        const float scale = BINS / (hi[bestAxis] - lo[bestAxis]);
+        const unsigned int* pivot = std::partition(m_items.data() + first, m_items.data() + first + count, [&](const unsigned int item)
+        {
+            return std::min(BINS - 1, (int)((build.centroids[item][bestAxis] - lo[bestAxis]) * scale)) <= bestBin;
+        });
+        middle = (unsigned int)(pivot - m_items.data());
+    }
+
+    m_nodes[self].count = 0;
+    split(build, first, middle - first, depth + 1);
+    m_nodes[self].index = (unsigned int)m_nodes.size();
+    split(build, middle, first + count - middle, depth + 1);
+}
+
+inline void Bvh::refit(const std::vector<Aabb>& boxes)
+{
+    for (size_t n = m_nodes.size(); n-- > 0;)
+    {
+        Node& node = m_nodes[n];
+        Aabb bounds;
+        if (node.count)
+        {
+            bounds = boxes[m_items[node.index]];
+            for (unsigned int i = node.index + 1; i < node.index + node.count; ++i)
+                grow(bounds, boxes[m_items[i]]);
+        }
+        else
+        {
+            const Node& a = m_nodes[n + 1];
+            const Node& b = m_nodes[node.index];
+            bounds.min = glm::min(a.min, b.min);
+            bounds.max = glm::max(a.max, b.max);
+        }
+        node.min = bounds.min;
+        node.max = bounds.max;
+    }
+}
+
+template <typename Visit>
+inline void Bvh::cull(const Frustum& frustum, Visit&& visit) const
+{
+    if (m_nodes.empty())
+        return;
+
+    // node, planes still to test
+    struct Entry
+    {
+        unsigned int node;
+        unsigned int planes;
+    };
+    Entry stack[STACK];
+    int top = 0;
+    stack[top++] = { 0, (1u << Frustum::ePLANE_COUNT) - 1 };
+
+    while (top > 0)
+    {
+        const Entry entry = stack[--top];
+        const Node& node = m_nodes[entry.node];
+
+        unsigned int planes = entry.planes;
+        bool outside = false;
+        for (int p = 0; p < Frustum::ePLANE_COUNT && !outside; ++p)
+        {
+            if (!(planes & (1u << p)))
+                continue;
+            const glm::vec4& plane = frustum.planes[p];
+            // farthest and nearest corner along the normal
+            const glm::vec3 far(plane.x > 0.0f ? node.max.x : node.min.x, plane.y > 0.0f ? node.max.y : node.min.y, plane.z > 0.0f ? node.max.z : node.min.z);
+            const glm::vec3 near(plane.x > 0.0f ? node.min.x : node.max.x, plane.y > 0.0f ? node.min.y : node.max.y, plane.z > 0.0f ? node.min.z : node.max.z);
+            const glm::vec3 normal(plane);
+            if (glm::dot(normal, far) + plane.w < 0.0f)
+                outside = true;
+            else if (glm::dot(normal, near) + plane.w >= 0.0f)
+                planes &= ~(1u << p);
+        }
+        if (outside)
+            continue;
+
+        if (planes == 0)
+        {
+            // the whole subtree, its leaves are one run of items: from the leftmost leaf to the end of the rightmost
+            unsigned int first = entry.node, last = entry.node;
+            while (m_nodes[first].count == 0)
+                ++first;
+            while (m_nodes[last].count == 0)
+                last = m_nodes[last].index;
+            const unsigned int begin = m_nodes[first].index;
+            visit(begin, m_nodes[last].index + m_nodes[last].count - begin, true);
+            continue;
+        }
+
+        if (node.count)
+            visit(node.index, node.count, false);
+        else
+        {
+            stack[top++] = { node.index, planes };
+            stack[top++] = { entry.node + 1, planes };
+        }
+    }
+}
+
+template <typename Hit>
+inline float Bvh::raycast(const Ray& ray, float tMax, Hit&& hit) const
+{
+    if (m_nodes.empty())
+        return tMax;
+
+    float entry = 0.0f;
+    if (!ray.intersects(Aabb{ m_nodes[0].min, m_nodes[0].max }, tMax, entry))
+        return tMax;
+
+    struct Entry
+    {
+        unsigned int node;
+        float t;
+    };
+    Entry stack[STACK];
+    int top = 0;
+    stack[top++] = { 0, entry };
+
+    while (top > 0)
+    {
+        const Entry e = stack[--top];
+        if (e.t > tMax)
+            continue;
+
+        const Node& node = m_nodes[e.node];
+        if (node.count)
+        {
+            for (unsigned int i = node.index; i < node.index + node.count; ++i)
+                tMax = std::min(tMax, hit(m_items[i], tMax));
+            continue;
+        }
+
+        const unsigned int a = e.node + 1, b = node.index;
+        float ta = 0.0f, tb = 0.0f;
+        const bool hitA = ray.intersects(Aabb{ m_nodes[a].min, m_nodes[a].max }, tMax, ta);
+        const bool hitB = ray.intersects(Aabb{ m_nodes[b].min, m_nodes[b].max }, tMax, tb);
+        // the nearer child is popped first
+        if (hitA && hitB)
+        {
+            stack[top++] = ta <= tb ? Entry{ b, tb } : Entry{ a, ta };
+            stack[top++] = ta <= tb ? Entry{ a, ta } : Entry{ b, tb };
+        }
+        else if (hitA)
+            stack[top++] = { a, ta };
+        else if (hitB)
+            stack[top++] = { b, tb };
+    }
+    return tMax;
+}
+
+} // namespace model
@@ -0,0 +1,294 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+/*
+DDS container for block compressed textures:
+
+    "DDS " + DDS_HEADER (+ DDS_HEADER_DXT10 when the fourCC is 'DX10') + every mip level, largest first.
+
+    Written with the DX10 header, read with either: legacy DXT1 / DXT5 / ATI1 / BC4U / ATI2 / BC5U fourCCs
+    are accepted too, so files from other tools load as well.
+    Only 2D textures of the formats below, no arrays, cube maps or volumes.
+*/
+
+// EXT_texture_compression_s3tc, not part of the core profile glad was generated for
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT  0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+namespace model
+{
+namespace dds
+{
+
+enum eFormat
+{
+    eUNKNOWN = 0,
+    eBC1,   // rgb, 4 bpp
+    eBC3,   // rgba, 8 bpp
+    eBC4,   // r, 4 bpp
+    eBC5    // rg, 8 bpp
+};
+
+struct Level
+{
+    int width;
+    int height;
+    size_t offset; // into Texture::data
+    size_t size;
+};
+
+struct Texture
+{
+    eFormat format = eUNKNOWN;
+    std::vector<Level> levels;
+    std::vector<unsigned char> data;
+};
+
+// bytes per 4x4 block
+size_t blockSize(const eFormat format);
+size_t levelSize(const eFormat format, const int width, const int height);
+GLenum glFormat(const eFormat format);
+
+bool read(const std::string& path, Texture& texture);
+bool write(const std::string& path, const Texture& texture);
+
+//////////////////// IMPLEMENTATION ////////////////////
+
+namespace detail
+{
+
+const uint32_t MAGIC = 0x20534444; // "DDS "
+// largest width / height read, the GL_MAX_TEXTURE_SIZE of current hardware
+const uint32_t MAX_SIZE = 16384;
+
+const uint32_t DDSD_CAPS        = 0x1;
+const uint32_t DDSD_HEIGHT      = 0x2;
+const uint32_t DDSD_WIDTH       = 0x4;
+const uint32_t DDSD_PIXELFORMAT = 0x1000;
+const uint32_t DDSD_MIPMAPCOUNT = 0x20000;
+const uint32_t DDSD_LINEARSIZE  = 0x80000;
+
+const uint32_t DDPF_FOURCC = 0x4;
+
+const uint32_t DDSCAPS_COMPLEX = 0x8;
+const uint32_t DDSCAPS_TEXTURE = 0x1000;
+const uint32_t DDSCAPS_MIPMAP  = 0x400000;
+
+const uint32_t DXGI_FORMAT_BC1_UNORM = 71;
+const uint32_t DXGI_FORMAT_BC3_UNORM = 77;
+const uint32_t DXGI_FORMAT_BC4_UNORM = 80;
+const uint32_t DXGI_FORMAT_BC5_UNORM = 83;
+const uint32_t D3D10_RESOURCE_DIMENSION_TEXTURE2D = 3;
+
+struct PixelFormat
+{
+    uint32_t size;
+    uint32_t flags;
+    uint32_t fourCC;
+    uint32_t rgbBitCount;
+    uint32_t rBitMask;
+    uint32_t gBitMask;
+    uint32_t bBitMask;
+    uint32_t aBitMask;
+};
+
+struct Header
+{
+    uint32_t size;
+    uint32_t flags;
+    uint32_t height;
+    uint32_t width;
+    uint32_t pitchOrLinearSize;
+    uint32_t depth;
+    uint32_t mipMapCount;
+    uint32_t reserved1[11];
+    PixelFormat pixelFormat;
+    uint32_t caps;
+    uint32_t caps2;
+    uint32_t caps3;
+    uint32_t caps4;
+    uint32_t reserved2;
+};
+
+struct HeaderDX10
+{
+    uint32_t dxgiFormat;
+    uint32_t resourceDimension;
+    uint32_t miscFlag;
+    uint32_t arraySize;
+    uint32_t miscFlags2;
+};
+
+inline uint32_t fourCC(const char a, const char b, const char c, const char d)
+{
+    return (uint32_t)(unsigned char)a | ((uint32_t)(unsigned char)b << 8) | ((uint32_t)(unsigned char)c << 16) | ((uint32_t)(unsigned char)d << 24);
+}
+
+inline eFormat fromFourCC(const uint32_t code)
+{
+    if (code == fourCC('D', 'X', 'T', '1'))
+        return eBC1;
+    if (code == fourCC('D', 'X', 'T', '5'))
+        return eBC3;
+    if (code == fourCC('A', 'T', 'I', '1') || code == fourCC('B', 'C', '4', 'U'))
+        return eBC4;
+    if (code == fourCC('A', 'T', 'I', '2') || code == fourCC('B', 'C', '5', 'U'))
+        return eBC5;
+    return eUNKNOWN;
+}
+
+inline eFormat fromDXGI(const uint32_t format)
+{
+    switch (format)
+    {
+    case DXGI_FORMAT_BC1_UNORM: return eBC1;
+    case DXGI_FORMAT_BC3_UNORM: return eBC3;
+    case DXGI_FORMAT_BC4_UNORM: return eBC4;
+    case DXGI_FORMAT_BC5_UNORM: return eBC5;
+    default:                    return eUNKNOWN;
+    }
+}
+
+inline uint32_t toDXGI(const eFormat format)
+{
+    switch (format)
+    {
+    case eBC1: return DXGI_FORMAT_BC1_UNORM;
+    case eBC3: return DXGI_FORMAT_BC3_UNORM;
+    case eBC4: return DXGI_FORMAT_BC4_UNORM;
+    case eBC5: return DXGI_FORMAT_BC5_UNORM;
+    default:   return 0;
+    }
+}
+
+} // namespace detail
+
+inline size_t blockSize(const eFormat format)
+{
+    return format == eBC1 || format == eBC4 ? 8 : 16;
+}
+
+inline size_t levelSize(const eFormat format, const int width, const int height)
+{
+    const size_t blocksX = (size_t)(width + 3) / 4;
+    const size_t blocksY = (size_t)(height + 3) / 4;
+    return blocksX * blocksY * blockSize(format);
+}
+
+inline GLenum glFormat(const eFormat format)
+{
+    switch (format)
+    {
+    case eBC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    case eBC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    case eBC4: return GL_COMPRESSED_RED_RGTC1;
+    case eBC5: return GL_COMPRESSED_RG_RGTC2;
+    default:   return 0;
+    }
+}
+
+inline bool read(const std::string& path, Texture& texture)
+{
+    std::ifstream is(path, std::ios::binary);
+    if (!is)
+        return false;
+    std::vector<unsigned char> file((std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
+
+    size_t offset = sizeof(uint32_t) + sizeof(detail::Header);
+    if (file.size() < offset)
+        return false;
+
+    uint32_t magic;
+    detail::Header header;
+    std::memcpy(&magic, file.data(), sizeof(magic));
+    std::memcpy(&header, file.data() + sizeof(magic), sizeof(header));
+    if (magic != detail::MAGIC || header.size != sizeof(detail::Header) || !(header.pixelFormat.flags & detail::DDPF_FOURCC))
+        return false;
+
+    eFormat format = detail::fromFourCC(header.pixelFormat.fourCC);
+    if (header.pixelFormat.fourCC == detail::fourCC('D', 'X', '1', '0'))
+    {
+        detail::HeaderDX10 dx10;
+        if (file.size() < offset + sizeof(dx10))
+            return false;
+        std::memcpy(&dx10, file.data() + offset, sizeof(dx10));
+        offset += sizeof(dx10);
+
+        if (dx10.resourceDimension != detail::D3D10_RESOURCE_DIMENSION_TEXTURE2D || dx10.arraySize > 1)
+            return false;
+        format = detail::fromDXGI(dx10.dxgiFormat);
+    }
+    if (format == eUNKNOWN || header.width == 0 || header.height == 0 ||
+        header.width > detail::MAX_SIZE || header.height > detail::MAX_SIZE)
+        return false;
+
+    const unsigned int mipCount = (header.flags & detail::DDSD_MIPMAPCOUNT) && header.mipMapCount ? header.mipMapCount : 1;
+
+    texture.format = format;
+    texture.levels.clear();
+    int width  = (int)header.width;
+    int height = (int)header.height;
+    size_t dataOffset = 0;
+    for (unsigned int i = 0; i < mipCount; ++i)
+    {
+        const size_t size = levelSize(format, width, height);
+        if (size > file.size() - offset - dataOffset)
+            return false;
+
+        texture.levels.push_back({ width, height, dataOffset, size });
+        dataOffset += size;
+
+        if (width == 1 && height == 1)
+            break;
+        width  = std::max(1, width / 2);
+        height = std::max(1, height / 2);
+    }
+
+    texture.data.assign(file.begin() + offset, file.begin() + offset + dataOffset);
+    return true;
+}
+
+inline bool write(const std::string& path, const Texture& texture)
+{
+    if (texture.levels.empty() || texture.format == eUNKNOWN)
+        return false;
+
+    detail::Header header = {};
+    header.size   = sizeof(detail::Header);
+    header.flags  = detail::DDSD_CAPS | detail::DDSD_HEIGHT | detail::DDSD_WIDTH | detail::DDSD_PIXELFORMAT |
+                    detail::DDSD_MIPMAPCOUNT | detail::DDSD_LINEARSIZE;
+    header.height = (uint32_t)texture.levels[0].height;
+    header.width  = (uint32_t)texture.levels[0].width;
+    header.pitchOrLinearSize = (uint32_t)texture.levels[0].size;
+    header.mipMapCount = (uint32_t)texture.levels.size();
+    header.pixelFormat.size   = sizeof(detail::PixelFormat);
+    header.pixelFormat.flags  = detail::DDPF_FOURCC;
+    header.pixelFormat.fourCC = detail::fourCC('D', 'X', '1', '0');
+    header.caps = detail::DDSCAPS_TEXTURE | (texture.levels.size() > 1 ? detail::DDSCAPS_MIPMAP | detail::DDSCAPS_COMPLEX : 0);
+
+    detail::HeaderDX10 dx10 = {};
+    dx10.dxgiFormat        = detail::toDXGI(texture.format);
+    dx10.resourceDimension = detail::D3D10_RESOURCE_DIMENSION_TEXTURE2D;
+    dx10.arraySize         = 1;
+
+    std::ofstream os(path, std::ios::binary | std::ios::trunc);
+    os.write((const char*)&detail::MAGIC, sizeof(detail::MAGIC));
+    os.write((const char*)&header, sizeof(header));
+    os.write((const char*)&dx10, sizeof(dx10));
+    os.write((const char*)texture.data.data(), texture.data.size());
+    return (bool)os;
+}
+
+} // namespace dds
+} // namespace model
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+/*
+Per instance world matrices for instanced draws:
+
+    * the 3 rows of the affine matrix, 48 bytes per instance, read as vertex attributes LOCATION .. LOCATION + 2
+      with divisor 1 (aInstance0..2 in vertex.vs / packed.vs, which use them when the "instanced" uniform is set)
+    * add() stages every instance of a pass, upload() sends them at once and orphans the previous storage,
+      the draws of the frame before may still read it
+    * GL 3.3 has no base instance: bind() points the attributes of the bound vertex array at the first instance
+      of a draw, unbind() disables them again so plain draws of the same vertex array read the "model" uniform
+*/
+
+namespace model
+{
+
+class InstanceBuffer
+{
+public:
+    // after the eAttribute locations
+    static const unsigned int LOCATION = 7;
+
+    InstanceBuffer() = default;
+    InstanceBuffer(const InstanceBuffer&) = delete;
+    InstanceBuffer& operator=(const InstanceBuffer&) = delete;
+    InstanceBuffer(InstanceBuffer&& other) noexcept { *this = std::move(other); }
+    InstanceBuffer& operator=(InstanceBuffer&& other) noexcept;
+    ~InstanceBuffer() { release(); }
+
+    void release();
+
+    // staged instances, uploaded by the next upload()
+    void clear() { m_rows.clear(); }
+    void add(const glm::mat4& matrix);
+    void upload();
+    // as of the last upload()
+    size_t size() const { return m_count; }
+
+    // with a vertex array bound
+    void bind(const size_t first) const;
+    static void unbind();
+
+private:
+    unsigned int m_vbo = 0;
+    size_t       m_capacity = 0; // instances
+    size_t       m_count = 0;
+    std::vector<glm::vec4> m_rows; // staging
+};
+
+//////////////////// IMPLEMENTATION ////////////////////
+
+inline InstanceBuffer& InstanceBuffer::operator=(InstanceBuffer&& other) noexcept
+{
+    if (this != &other)
+    {
+        release();
+        m_vbo      = std::exchange(other.m_vbo, 0u);
+        m_capacity = std::exchange(other.m_capacity, (size_t)0);
+        m_count    = std::exchange(other.m_count, (size_t)0);
+        m_rows     = std::move(other.m_rows);
+    }
+    return *this;
+}
+
+inline void InstanceBuffer::release()
+{
+    if (m_vbo)
+        glDeleteBuffers(1, &m_vbo);
+    m_vbo = 0;
+    m_capacity = m_count = 0;
+}
+
+inline void InstanceBuffer::add(const glm::mat4& matrix)
+{
+    // rows: glm is column major
+    m_rows.push_back(glm::vec4(matrix[0][0], matrix[1][0], matrix[2][0], matrix[3][0]));
+    m_rows.push_back(glm::vec4(matrix[0][1], matrix[1][1], matrix[2][1], matrix[3][1]));
+    m_rows.push_back(glm::vec4(matrix[0][2], matrix[1][2], matrix[2][2], matrix[3][2]));
+}
+
+inline void InstanceBuffer::upload()
+{
+    m_count = m_rows.size() / 3;
+    if (m_count == 0)
+        return;
+
+    if (!m_vbo)
+        glGenBuffers(1, &m_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
+    // orphan, grown in powers of two
+    if (m_capacity < m_count)
+        m_capacity = std::max(m_count, m_capacity * 2);
+    glBufferData(GL_ARRAY_BUFFER, m_capacity * 3 * sizeof(glm::vec4), nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, m_rows.size() * sizeof(glm::vec4), m_rows.data());
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+inline void InstanceBuffer::bind(const size_t first) const
+{
+    glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
+    const GLsizei stride = 3 * sizeof(glm::vec4);
+    for (unsigned int row = 0; row < 3; ++row)
+    {
+        glEnableVertexAttribArray(LOCATION + row);
+        glVertexAttribPointer(LOCATION + row, 4, GL_FLOAT, GL_FALSE, stride, (const void*)(first * stride + row * sizeof(glm::vec4)));
+        glVertexAttribDivisor(LOCATION + row, 1);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+inline void InstanceBuffer::unbind()
+{
+    for (unsigned int row = 0; row < 3; ++row)
+        glDisableVertexAttribArray(LOCATION + row);
+}
+
+} // namespace model
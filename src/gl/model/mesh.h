@@ -8,29 +8,28 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include "model/bounds.h"
+#include "model/bvh.h"
+#include "model/instanceBuffer.h"
+#include "model/meshBuffer.h"
+#include "model/meshSimplifier.h"
+#include "model/meshlet.h"
+#include "model/occlusionBuffer.h"
+#include "model/sceneGraph.h"
+#include "model/vertexFormat.h"
 #include "shaderManager/ShaderManager.h"
 
+#include <algorithm>
+#include <cfloat>
+#include <cstdint>
+#include <iostream>
 #include <string>
+#include <utility>
 #include <vector>
 
 namespace model
 {
 
-#define MAX_BONE_INFLUENCE 4
-
-struct Vertex 
-{
-    glm::vec3 Position;
-    glm::vec3 Normal;
-    glm::vec2 TexCoords;
-    glm::vec3 Tangent;
-    glm::vec3 Bitangent;
-    //bone indexes which will influence this vertex
-    int m_BoneIDs[MAX_BONE_INFLUENCE];
-    //weights from each bone
-    float m_Weights[MAX_BONE_INFLUENCE];
-};
-
 struct Texture 
 {
     unsigned int id;
@@ -38,41 +37,317 @@ struct Texture
     std::string name; // filename
 };
 
+// what a draw culls and selects with, built at import and stored in the mesh cache
+struct MeshDetail
+{
+    Aabb                 box;      // mesh space, before the node transform
+    Sphere               bounds;   // mesh space
+    std::vector<Meshlet> meshlets; // ImportSettings::meshlets, ranges of level 0
+    std::vector<Lod>     lods;     // ImportSettings::lods, empty: the whole index buffer is one level
+
+    // index count of the full detail mesh
+    size_t baseIndexCount(const size_t indexCount) const { return lods.empty() ? indexCount : lods[0].indexCount; }
+};
+
+// cpu side result of the import, before upload
+struct MeshData
+{
+    std::vector<Vertex>       vertices;
+    std::vector<unsigned int> indices;  // every level, back to back
+    std::vector<Texture>      textures;
+    unsigned int              attributes = 1u << ePOSITION; // eAttribute bits the import filled
+    MeshDetail                detail;
+
+    MeshSource source() const { return { vertices.data(), vertices.size(), indices.data(), indices.size(), GL_UNSIGNED_INT, attributes }; }
+};
+
+// gpu layout, set before loading, shared by every mesh
+struct UploadSettings
+{
+    bool packVertices = false; // PackedVertex, needs resources/shader/packed.vs
+    unsigned int attributes = ALL_ATTRIBUTES; // what the program reads, see ShaderManager::activeAttributes()
+    bool positionStream = false; // positions in a buffer of their own, for DrawDepth()
+    bool sharedBuffer = false;   // one MeshBuffer per Model, every mesh a range of it
+    bool keepGeometry = true;    // Mesh::m_vertices / m_indices keep level 0 at least after upload, picks hit triangles and occluders have geometry
+};
+
+// what a draw submitted
+struct DrawStats
+{
+    unsigned int meshes = 0;         // drawn, inside the view
+    unsigned int meshesCulled = 0;   // whole meshes outside the view
+    unsigned int meshesOccluded = 0; // inside the view, hidden behind occluders (CullSettings::occlusion)
+    unsigned int meshlets = 0;       // tested against the view
+    unsigned int meshletsCulled = 0;
+    unsigned int draws = 0;          // draw calls
+    unsigned int triangles = 0;
+    unsigned int lodMeshes = 0;      // meshes drawn below level 0
+    unsigned int instanced = 0;      // meshes drawn as part of an instanced draw
+    unsigned int queryDraws = 0;     // meshes drawn under conditional rendering (CullSettings::occlusionQueries)
+    unsigned int drawsSkipped = 0;   // of those, dropped by the gpu, counted when their results come in
+};
+
 class Mesh 
 {
 public:
-    // TODO: &&
-    Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices, std::vector<Texture> textures);
+    // [attributes]: eAttribute bits the vertices hold, only those the program reads too are uploaded.
+    // The geometry is freed after upload unless UploadSettings::keepGeometry
+    Mesh(std::vector<Vertex>&& vertices, std::vector<unsigned int>&& indices, std::vector<Texture>&& textures, const unsigned int attributes = ALL_ATTRIBUTES);
+    // upload only, e.g. data mapped from the mesh cache. m_vertices and m_indices stay empty until keepBaseLevel()
+    Mesh(const MeshSource& source, std::vector<Texture>&& textures);
+    // a range of a buffer the model owns and outlives the mesh, nothing is uploaded
+    Mesh(const MeshBuffer& buffer, const DrawRange& range, std::vector<Texture>&& textures);
+
+    // owns its GL objects: move only
+    Mesh(const Mesh&) = delete;
+    Mesh& operator=(const Mesh&) = delete;
+    Mesh(Mesh&&) noexcept = default;
+    Mesh& operator=(Mesh&&) noexcept = default;
     
-    void Draw(ShaderManager& shader);
+    // bindBuffer false: the caller has bound the buffer already, e.g. a model drawing its shared buffer.
+    // view: mesh space (WorldView::local()), meshlets outside it or facing away are skipped and the level of detail is picked for it
+    void Draw(ShaderManager& shader, const bool bindBuffer = true, const CullView* view = nullptr, DrawStats* stats = nullptr);
+    // positions only, no textures: depth prepass / shadow maps. Reads 12 bytes per vertex (8 packed) when the
+    // mesh was uploaded with UploadSettings::positionStream, the whole vertex otherwise
+    void DrawDepth(ShaderManager& shader, const bool bindBuffer = true, const CullView* view = nullptr, DrawStats* stats = nullptr);
+    // instances [first, first + count) of [instances] in one draw. view: picks the level only, meshlets are
+    // culled per instance and so not at all here
+    void DrawInstanced(ShaderManager& shader, const InstanceBuffer& instances, const size_t first, const GLsizei count,
+                       const bool bindBuffer = true, const CullView* view = nullptr, DrawStats* stats = nullptr);
+    void DrawDepthInstanced(ShaderManager& shader, const InstanceBuffer& instances, const size_t first, const GLsizei count,
+                            const bool bindBuffer = true, const CullView* view = nullptr, DrawStats* stats = nullptr);
+
+    // with UploadSettings::keepGeometry, for meshes built from a source or a buffer range: copies level 0 of
+    // [source] (m_detail set already) to m_vertices / m_indices
+    void keepBaseLevel(const MeshSource& source);
+
+    static UploadSettings& uploadSettings();
+
+    static std::vector<uint16_t> narrowIndices(const std::vector<unsigned int>& indices);
 
 private:
-    void setupMesh();
+    void setupMesh(const MeshSource& source);
+    void bindTextures(ShaderManager& shader) const;
+    void setPositionUniforms(ShaderManager& shader) const;
+    // the level [view] calls for, or the visible meshlets of level 0 with neighbours merged into one draw.
+    // instances > 1: the level only, every draw instanced
+    void drawRanges(const CullView* view, DrawStats* stats, const GLsizei instances = 1) const;
+    const MeshBuffer& buffer() const { return m_shared ? *m_shared : m_buffer; }
 
 public:
     // mesh Data
     std::vector<Vertex>       m_vertices;
     std::vector<unsigned int> m_indices;
     std::vector<Texture>      m_textures;
+    MeshDetail                m_detail;
     
     // render data 
-    unsigned int m_vao; 
-    unsigned int m_vbo;
-    unsigned int m_ebo;
+    MeshBuffer        m_buffer;           // own, empty for a range of a shared buffer
+    const MeshBuffer* m_shared = nullptr; // the model's
+    DrawRange         m_range;
+};
+
+// one reference of a mesh by a scene node: the mesh is uploaded once, every reference draws it placed by its node
+struct MeshInstance
+{
+    unsigned int mesh;
+    unsigned int node;
+};
+
+// what culls whole meshes besides the frustum, set at any time, shared by every model
+struct CullSettings
+{
+    bool occlusion = false;               // software occlusion culling, see OcclusionBuffer
+    unsigned int occluders = 16;          // largest visible instances on screen drawn into the OcclusionBuffer
+    unsigned int occluderTriangles = 65536; // per frame, meshes above are never occluders
+    bool occlusionQueries = false;        // hardware queries per instance box, see OcclusionQueries
+    unsigned int queriesPerFrame = 64;    // boxes drawn per frame, the visible instances take turns
+};
+
+// visible instances of one mesh, see MeshCuller::runs()
+struct InstanceRun
+{
+    unsigned int mesh;
+    unsigned int first; // into MeshCuller::order()
+    unsigned int count;
+};
+
+// nearest hit of a ray on a model's meshes
+struct PickHit
+{
+    float        distance = 0.0f;              // along the ray, in units of its direction
+    glm::vec3    position = glm::vec3(0.0f);   // world space
+    unsigned int instance = 0;
+    unsigned int mesh = 0;
+    int          triangle = -1;                // of level 0, -1: the mesh kept no geometry and its box was hit
+};
+
+// whole mesh instances against the view and against rays, through a Bvh over their world space boxes. Leaves
+// partly in view are tested 8 boxes at a time by a BoxSet kept in leaf order. Picking tests the triangles of
+// level 0 in mesh space through a Bvh per mesh, shared by its instances and built the first time a ray reaches one
+class MeshCuller
+{
+public:
+    // instance i draws meshes[instances[i].mesh] placed by graph.world(instances[i].node). Instances added since
+    // the last call rebuild the tree, [moved] (SceneGraph::update() returned true) refits it
+    void place(const std::vector<Mesh>& meshes, const std::vector<MeshInstance>& instances, const SceneGraph& graph, const bool moved);
+
+    static CullSettings& settings();
+
+    // instances placed so far and their world space boxes
+    size_t size() const { return m_boxesByInstance.size(); }
+    const Aabb& box(const size_t instance) const { return m_boxesByInstance[instance]; }
+
+    // world space, nullptr: everything is visible. Counts go to DrawStats::meshes / meshesCulled
+    void cull(const Frustum* frustum, DrawStats* stats = nullptr);
+    // after cull(): hides the visible instances behind the biggest ones on screen. Occluders are level 0 of
+    // meshes that kept their geometry (UploadSettings::keepGeometry). Moves counts to DrawStats::meshesOccluded
+    void occlude(const std::vector<Mesh>& meshes, const std::vector<MeshInstance>& instances, const SceneGraph& graph,
+                 const WorldView& view, DrawStats* stats = nullptr);
+    bool visible(const size_t instance) const { return m_visible[instance] != 0; }
+    // takes visible instances out of the runs
+    void hide(const std::vector<unsigned int>& instances);
+    // after cull(): the visible instances grouped by mesh, in mesh order
+    const std::vector<InstanceRun>& runs() const { return m_runs; }
+    const std::vector<unsigned int>& order() const { return m_order; }
+
+    // world space [ray] against the placed instances. Triangles need the mesh geometry (UploadSettings::keepGeometry),
+    // boxes stand in otherwise
+    bool pick(const std::vector<Mesh>& meshes, const std::vector<MeshInstance>& instances, const SceneGraph& graph,
+              const Ray& ray, PickHit& hit);
+
+private:
+    void sortBoxes();
+    // m_runs / m_order from m_visible
+    void group();
+    // closer than tMax: fills [hit], returns its distance
+    float pickMesh(const Mesh& mesh, const MeshInstance& instance, const unsigned int index, const glm::mat4& world,
+                   const Ray& ray, const float tMax, PickHit& hit);
+
+private:
+    Bvh                        m_bvh;
+    std::vector<Aabb>          m_boxesByInstance; // world space
+    std::vector<unsigned int>  m_meshOf;          // mesh of each instance
+    BoxSet                     m_boxes;           // leaf order
+    std::vector<unsigned char> m_visible;
+    std::vector<unsigned int>  m_order;
+    std::vector<InstanceRun>   m_runs;
+    std::vector<unsigned int>  m_runStart;        // scratch, per mesh
+    std::vector<Bvh>           m_triangles;       // per mesh, mesh space, empty until picked
+    OcclusionBuffer            m_occlusion;
+    std::vector<OcclusionBuffer::Occluder> m_occluders;
+    bool                       m_warnedNoOccluders = false;
 };
 
 //////////////////// IMPLEMENTATION ////////////////////
 
-Mesh::Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices, std::vector<Texture> textures)
+Mesh::Mesh(std::vector<Vertex>&& vertices, std::vector<unsigned int>&& indices, std::vector<Texture>&& textures, const unsigned int attributes)
+    : m_vertices(std::move(vertices)), m_indices(std::move(indices)), m_textures(std::move(textures))
 {
-    this->m_vertices = vertices;
-    this->m_indices = indices;
-    this->m_textures = textures;
+    setupMesh({ m_vertices.data(), m_vertices.size(), m_indices.data(), m_indices.size(), GL_UNSIGNED_INT, attributes });
+
+    if (!uploadSettings().keepGeometry)
+    {
+        std::vector<Vertex>().swap(m_vertices);
+        std::vector<unsigned int>().swap(m_indices);
+    }
+}
+
+Mesh::Mesh(const MeshSource& source, std::vector<Texture>&& textures)
+    : m_textures(std::move(textures))
+{
+    setupMesh(source);
+}
+
+Mesh::Mesh(const MeshBuffer& buffer, const DrawRange& range, std::vector<Texture>&& textures)
+    : m_textures(std::move(textures)), m_shared(&buffer), m_range(range)
+{
+}
+
+void Mesh::keepBaseLevel(const MeshSource& source)
+{
+    if (!uploadSettings().keepGeometry || !m_vertices.empty())
+        return;
+
+    const size_t count = m_detail.baseIndexCount(source.indexCount);
+    m_vertices.assign(source.vertices, source.vertices + source.vertexCount);
+    m_indices.resize(count);
+    if (source.indexType == GL_UNSIGNED_SHORT)
+        std::copy((const uint16_t*)source.indices, (const uint16_t*)source.indices + count, m_indices.begin());
+    else
+        std::copy((const unsigned int*)source.indices, (const unsigned int*)source.indices + count, m_indices.begin());
+}
+
+UploadSettings& Mesh::uploadSettings()
+{
+    static UploadSettings settings;
+    return settings;
+}
+
+std::vector<uint16_t> Mesh::narrowIndices(const std::vector<unsigned int>& indices)
+{
+    return std::vector<uint16_t>(indices.begin(), indices.end());
+}
+
+void Mesh::setPositionUniforms(ShaderManager& shader) const
+{
+    if (buffer().packed())
+    {
+        glUniform3fv(glGetUniformLocation(shader.getId(), "positionOffset"), 1, &m_range.positionOffset[0]);
+        glUniform3fv(glGetUniformLocation(shader.getId(), "positionScale"), 1, &m_range.positionScale[0]);
+    }
+}
+
+void Mesh::drawRanges(const CullView* view, DrawStats* stats, const GLsizei instances) const
+{
+    DrawStats local;
+    DrawStats& s = stats ? *stats : local;
+    const size_t indexSize = MeshBuffer::indexSize(m_range.indexType);
+    DrawRange part = m_range;
+    auto flush = [&]()
+    {
+        if (part.indexCount)
+        {
+            MeshBuffer::draw(part, instances);
+            ++s.draws;
+            s.triangles += part.indexCount / 3 * instances;
+        }
+        part.indexCount = 0;
+    };
+
+    const unsigned int level = view ? MeshSimplifier::selectLod(m_detail.lods, m_detail.bounds, *view) : 0;
+    if (instances > 1)
+        s.instanced += instances;
+    if (level > 0 || !view || m_detail.meshlets.empty() || instances > 1)
+    {
+        if (!m_detail.lods.empty())
+        {
+            part.indexOffset = m_range.indexOffset + m_detail.lods[level].firstIndex * indexSize;
+            part.indexCount = (GLsizei)m_detail.lods[level].indexCount;
+        }
+        s.lodMeshes += level > 0 ? instances : 0;
+        flush();
+        return;
+    }
 
-    setupMesh();
+    part.indexCount = 0;
+    s.meshlets += (unsigned int)m_detail.meshlets.size();
+    for (const Meshlet& meshlet : m_detail.meshlets)
+    {
+        if (!MeshletBuilder::visible(meshlet, *view))
+        {
+            ++s.meshletsCulled;
+            flush();
+            continue;
+        }
+        if (part.indexCount == 0)
+            part.indexOffset = m_range.indexOffset + meshlet.firstIndex * indexSize;
+        part.indexCount += meshlet.indexCount;
+    }
+    flush();
 }
 
-void Mesh::Draw(ShaderManager& shader)
+void Mesh::bindTextures(ShaderManager& shader) const
 {
     // bind appropriate m_textures
     unsigned int diffuseNr  = 1;
@@ -99,57 +374,303 @@ void Mesh::Draw(ShaderManager& shader)
         // and finally bind the texture
         glBindTexture(GL_TEXTURE_2D, m_textures[i].id);
     }
+}
+
+void Mesh::Draw(ShaderManager& shader, const bool bindBuffer, const CullView* view, DrawStats* stats)
+{
+    bindTextures(shader);
+    setPositionUniforms(shader);
 
     // draw mesh
-    glBindVertexArray(m_vao);
-    glDrawElements(GL_TRIANGLES, m_indices.size(), GL_UNSIGNED_INT, 0);
+    if (bindBuffer)
+        buffer().bind();
+    drawRanges(view, stats);
     
     // set everything back to defaults once configured.
-    glBindVertexArray(0);
+    if (bindBuffer)
+        glBindVertexArray(0);
     glActiveTexture(GL_TEXTURE0);
 }
 
-void Mesh::setupMesh()
+void Mesh::DrawDepth(ShaderManager& shader, const bool bindBuffer, const CullView* view, DrawStats* stats)
+{
+    setPositionUniforms(shader);
+
+    if (bindBuffer)
+        buffer().bindDepth();
+    drawRanges(view, stats);
+    if (bindBuffer)
+        glBindVertexArray(0);
+}
+
+void Mesh::DrawInstanced(ShaderManager& shader, const InstanceBuffer& instances, const size_t first, const GLsizei count,
+                         const bool bindBuffer, const CullView* view, DrawStats* stats)
+{
+    bindTextures(shader);
+    setPositionUniforms(shader);
+
+    if (bindBuffer)
+        buffer().bind();
+    instances.bind(first);
+    drawRanges(view, stats, count);
+    InstanceBuffer::unbind();
+    if (bindBuffer)
+        glBindVertexArray(0);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+void Mesh::DrawDepthInstanced(ShaderManager& shader, const InstanceBuffer& instances, const size_t first, const GLsizei count,
+                              const bool bindBuffer, const CullView* view, DrawStats* stats)
+{
+    setPositionUniforms(shader);
+
+    if (bindBuffer)
+        buffer().bindDepth();
+    instances.bind(first);
+    drawRanges(view, stats, count);
+    InstanceBuffer::unbind();
+    if (bindBuffer)
+        glBindVertexArray(0);
+}
+
+void Mesh::setupMesh(const MeshSource& source)
 {
-    glGenVertexArrays(1, &m_vao);
-    glGenBuffers(1, &m_vbo);
-    glGenBuffers(1, &m_ebo);
+    const UploadSettings& settings = uploadSettings();
+    std::vector<DrawRange> ranges;
+    m_buffer.create({ source }, settings.attributes, settings.packVertices, settings.positionStream, ranges);
+    m_range = ranges[0];
+}
 
-    glBindVertexArray(m_vao);
-    glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
-    // TODO: alignment
-    glBufferData(GL_ARRAY_BUFFER, m_vertices.size() * sizeof(Vertex), &m_vertices[0], GL_STATIC_DRAW);
+void MeshCuller::place(const std::vector<Mesh>& meshes, const std::vector<MeshInstance>& instances, const SceneGraph& graph, const bool moved)
+{
+    const size_t placed = m_boxesByInstance.size();
+    if (instances.size() == placed && !moved)
+        return;
+
+    m_boxesByInstance.resize(instances.size());
+    m_meshOf.resize(instances.size());
+    for (size_t i = moved ? 0 : placed; i < instances.size(); ++i)
+    {
+        m_boxesByInstance[i] = meshes[instances[i].mesh].m_detail.box.transformed(graph.world(instances[i].node));
+        m_meshOf[i] = instances[i].mesh;
+    }
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_indices.size() * sizeof(unsigned int), &m_indices[0], GL_STATIC_DRAW);
+    if (instances.size() == placed)
+        m_bvh.refit(m_boxesByInstance);
+    else
+        m_bvh.build(m_boxesByInstance);
+    // meshes are only appended, the triangle trees built so far still match
+    if (meshes.size() < m_triangles.size())
+        m_triangles.clear();
+    m_triangles.resize(meshes.size());
+    sortBoxes();
+}
 
-    // attributes
+void MeshCuller::cull(const Frustum* frustum, DrawStats* stats)
+{
+    const size_t count = m_boxesByInstance.size();
+    m_visible.assign(count, frustum ? 0 : 1);
+    size_t visible = count;
+    if (frustum)
     {
-        // vertex Positions
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)0);
-        // vertex normals
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, Normal));
-        // vertex texture coords
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, TexCoords));
-        // vertex tangent
-        glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, Tangent));
-        // vertex bitangent
-        glEnableVertexAttribArray(4);
-        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, Bitangent));
-        // ids
-        glEnableVertexAttribArray(5);
-        glVertexAttribIPointer(5, 4, GL_INT, sizeof(Vertex), (void *)offsetof(Vertex, m_BoneIDs));
+        visible = 0;
+        const std::vector<unsigned int>& items = m_bvh.items();
+        unsigned char leaf[Bvh::MAX_LEAF];
+        m_bvh.cull(*frustum, [&](const unsigned int first, const unsigned int n, const bool inside)
+        {
+            if (inside)
+            {
+                for (unsigned int k = 0; k < n; ++k)
+                    m_visible[items[first + k]] = 1;
+                visible += n;
+                return;
+            }
+            visible += m_boxes.cull(*frustum, leaf, first, first + n);
+            for (unsigned int k = 0; k < n; ++k)
+                m_visible[items[first + k]] = leaf[k];
+        });
+    }
 
-        // weights
-        glEnableVertexAttribArray(6);
-        glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, m_Weights));
+    group();
+    if (stats)
+    {
+        stats->meshes += (unsigned int)visible;
+        stats->meshesCulled += (unsigned int)(count - visible);
     }
+}
 
-    glBindVertexArray(0);
+CullSettings& MeshCuller::settings()
+{
+    static CullSettings settings;
+    return settings;
+}
+
+void MeshCuller::group()
+{
+    // counting sort of the visible instances by mesh, reference order within a mesh
+    const size_t count = m_boxesByInstance.size();
+    m_runStart.assign(m_triangles.size() + 1, 0);
+    for (size_t i = 0; i < count; ++i)
+        m_runStart[m_meshOf[i] + 1] += m_visible[i];
+    for (size_t mesh = 1; mesh < m_runStart.size(); ++mesh)
+        m_runStart[mesh] += m_runStart[mesh - 1];
+    m_runs.clear();
+    for (unsigned int mesh = 0; mesh + 1 < m_runStart.size(); ++mesh)
+    {
+        if (m_runStart[mesh + 1] > m_runStart[mesh])
+            m_runs.push_back({ mesh, m_runStart[mesh], m_runStart[mesh + 1] - m_runStart[mesh] });
+    }
+    m_order.resize(m_runStart.back());
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (m_visible[i])
+            m_order[m_runStart[m_meshOf[i]]++] = (unsigned int)i;
+    }
+}
+
+void MeshCuller::hide(const std::vector<unsigned int>& instances)
+{
+    if (instances.empty())
+        return;
+    for (const unsigned int i : instances)
+        m_visible[i] = 0;
+    group();
+}
+
+void MeshCuller::occlude(const std::vector<Mesh>& meshes, const std::vector<MeshInstance>& instances, const SceneGraph& graph,
+                         const WorldView& view, DrawStats* stats)
+{
+    // occluders: the visible instances biggest on screen, by box radius over distance
+    const CullSettings& s = settings();
+    const glm::vec3 eye = glm::vec3(glm::inverse(view.view)[3]);
+    std::vector<std::pair<float, unsigned int>> candidates;
+    for (const unsigned int i : m_order)
+    {
+        const Mesh& mesh = meshes[instances[i].mesh];
+        if (mesh.m_vertices.empty() || mesh.m_detail.baseIndexCount(mesh.m_indices.size()) / 3 > s.occluderTriangles)
+            continue;
+        const Aabb& box = m_boxesByInstance[i];
+        const float radius = glm::length(box.max - box.min) * 0.5f;
+        const float distance = glm::distance(eye, (box.min + box.max) * 0.5f);
+        candidates.push_back({ distance > radius ? radius / distance : FLT_MAX, i });
+    }
+    const size_t count = std::min<size_t>(s.occluders, candidates.size());
+    std::partial_sort(candidates.begin(), candidates.begin() + count, candidates.end(),
+                      [](const std::pair<float, unsigned int>& a, const std::pair<float, unsigned int>& b) { return a.first > b.first; });
+
+    m_occluders.clear();
+    size_t triangles = 0;
+    for (size_t c = 0; c < count; ++c)
+    {
+        const MeshInstance& instance = instances[candidates[c].second];
+        const Mesh& mesh = meshes[instance.mesh];
+        const size_t triangleCount = mesh.m_detail.baseIndexCount(mesh.m_indices.size()) / 3;
+        if (triangles + triangleCount > s.occluderTriangles)
+            continue;
+        triangles += triangleCount;
+        m_occluders.push_back({ mesh.m_vertices.data(), mesh.m_indices.data(), triangleCount, graph.world(instance.node) });
+    }
+    if (m_occluders.empty())
+    {
+        // visible meshes but none to test them against: nothing will ever be occluded
+        if (!m_order.empty() && !m_warnedNoOccluders)
+        {
+            std::cout << "MeshCuller:: occlusion is on but no visible mesh qualifies as occluder (level 0 kept by UploadSettings::keepGeometry, at most "
+                      << s.occluderTriangles << " triangles)" << std::endl;
+            m_warnedNoOccluders = true;
+        }
+        return;
+    }
+
+    m_occlusion.render(view.projection * view.view, m_occluders);
+    unsigned int occluded = 0;
+    for (const unsigned int i : m_order)
+    {
+        if (!m_occlusion.visible(m_boxesByInstance[i]))
+        {
+            m_visible[i] = 0;
+            ++occluded;
+        }
+    }
+    if (occluded == 0)
+        return;
+
+    group();
+    if (stats)
+    {
+        stats->meshes -= occluded;
+        stats->meshesOccluded += occluded;
+    }
+}
+
+void MeshCuller::sortBoxes()
+{
+    m_boxes.clear();
+    for (const unsigned int item : m_bvh.items())
+        m_boxes.add(m_boxesByInstance[item]);
+}
+
+bool MeshCuller::pick(const std::vector<Mesh>& meshes, const std::vector<MeshInstance>& instances, const SceneGraph& graph,
+                      const Ray& ray, PickHit& hit)
+{
+    const float distance = m_bvh.raycast(ray, FLT_MAX, [&](const unsigned int item, const float tMax)
+    {
+        const MeshInstance& instance = instances[item];
+        return pickMesh(meshes[instance.mesh], instance, item, graph.world(instance.node), ray, tMax, hit);
+    });
+    if (distance == FLT_MAX)
+        return false;
+
+    hit.distance = distance;
+    hit.position = ray.origin + ray.direction * distance;
+    return true;
+}
+
+float MeshCuller::pickMesh(const Mesh& mesh, const MeshInstance& instance, const unsigned int index, const glm::mat4& world,
+                           const Ray& ray, const float tMax, PickHit& hit)
+{
+    float t = 0.0f;
+    if (mesh.m_vertices.empty() || mesh.m_indices.empty())
+    {
+        if (!ray.intersects(m_boxesByInstance[index], tMax, t) || t >= tMax)
+            return tMax;
+        hit.instance = index;
+        hit.mesh = instance.mesh;
+        hit.triangle = -1;
+        return t;
+    }
+
+    const size_t triangleCount = mesh.m_detail.baseIndexCount(mesh.m_indices.size()) / 3;
+    const Vertex* vertices = mesh.m_vertices.data();
+    const unsigned int* indices = mesh.m_indices.data();
+    Bvh& triangles = m_triangles[instance.mesh];
+    if (triangles.empty())
+    {
+        std::vector<Aabb> boxes(triangleCount);
+        for (size_t i = 0; i < triangleCount; ++i)
+        {
+            const glm::vec3& a = vertices[indices[i * 3]].Position;
+            const glm::vec3& b = vertices[indices[i * 3 + 1]].Position;
+            const glm::vec3& c = vertices[indices[i * 3 + 2]].Position;
+            boxes[i].min = glm::min(a, glm::min(b, c));
+            boxes[i].max = glm::max(a, glm::max(b, c));
+        }
+        triangles.build(boxes, 4);
+    }
+
+    // the direction is not renormalized, distances stay those of the world space ray
+    const Ray local = ray.transformed(glm::inverse(world));
+    return triangles.raycast(local, tMax, [&](const unsigned int triangle, const float closest)
+    {
+        const unsigned int* i = indices + triangle * 3;
+        float d = 0.0f;
+        if (!local.intersects(vertices[i[0]].Position, vertices[i[1]].Position, vertices[i[2]].Position, d) || d >= closest)
+            return closest;
+        hit.instance = index;
+        hit.mesh = instance.mesh;
+        hit.triangle = (int)triangle;
+        return d;
+    });
 }
 
 } // namespace model
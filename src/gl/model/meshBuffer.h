@@ -0,0 +1,260 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "model/vertexFormat.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/*
+GPU storage of one or more meshes: a vertex array over one vertex buffer (two with a position stream) and one
+index buffer.
+
+    * every mesh is a DrawRange: its first vertex (base vertex) and the byte offset of its indices, drawn with
+      glDrawElementsBaseVertex so the indices stay relative to the mesh and keep fitting in 16 bit
+    * one VertexLayout for the whole buffer, the union of what the meshes have and the program reads, so every
+      range has the same stride. Meshes without an attribute read zeros there
+    * allocate() sizes the buffers, upload() fills one range: AsyncModel spreads the uploads over frames
+
+    Mesh owns a MeshBuffer holding just itself, or refers to the one its Model shares (UploadSettings::sharedBuffer).
+    Move only, the GL objects are deleted with the last owner, so it has to go before the context does.
+*/
+
+namespace model
+{
+
+// geometry of one mesh, not owned
+struct MeshSource
+{
+    const Vertex* vertices;
+    size_t        vertexCount;
+    const void*   indices;
+    size_t        indexCount;
+    GLenum        indexType;  // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+    unsigned int  attributes; // eAttribute bits the vertices hold
+};
+
+// one mesh inside a MeshBuffer
+struct DrawRange
+{
+    GLsizei   indexCount = 0;
+    GLenum    indexType = GL_UNSIGNED_INT;
+    size_t    indexOffset = 0; // bytes into the index buffer
+    GLint     baseVertex = 0;
+    GLsizei   vertexCount = 0;
+
+    // PackedVertex: position = offset + scale * unorm16
+    glm::vec3 positionOffset = glm::vec3(0.0f);
+    glm::vec3 positionScale  = glm::vec3(1.0f);
+};
+
+class MeshBuffer
+{
+public:
+    MeshBuffer() = default;
+    MeshBuffer(const MeshBuffer&) = delete;
+    MeshBuffer& operator=(const MeshBuffer&) = delete;
+    MeshBuffer(MeshBuffer&& other) noexcept { *this = std::move(other); }
+    MeshBuffer& operator=(MeshBuffer&& other) noexcept;
+    ~MeshBuffer() { release(); }
+
+    // deletes the GL objects, empty() afterwards
+    void release();
+
+    // sizes the buffers for [sources] and sets up the vertex arrays, no data yet. [ranges] gets one entry per source.
+    // attributes: what the program reads (UploadSettings::attributes), position is always kept
+    void allocate(const std::vector<MeshSource>& sources, const unsigned int attributes, const bool packed, const bool positionStream,
+                  std::vector<DrawRange>& ranges);
+    // fills the range allocate() gave [source]
+    void upload(const MeshSource& source, DrawRange& range) const;
+    // allocate + upload everything
+    void create(const std::vector<MeshSource>& sources, const unsigned int attributes, const bool packed, const bool positionStream,
+                std::vector<DrawRange>& ranges);
+
+    // the vertex array of every attribute, or of the positions only
+    void bind() const { glBindVertexArray(m_vao); }
+    void bindDepth() const { glBindVertexArray(m_depthVao ? m_depthVao : m_vao); }
+    // with the buffer bound, [instances] > 1: one instanced draw
+    static void draw(const DrawRange& range, const GLsizei instances = 1);
+
+    unsigned int attributes() const { return m_attributes; }
+    bool packed() const { return m_packed; }
+    bool empty() const { return m_vao == 0; }
+
+    // 16 bit whenever every vertex of a range is addressable with it
+    static GLenum indexType(const size_t vertexCount) { return vertexCount <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT; }
+    static size_t indexSize(const GLenum type) { return type == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t); }
+
+private:
+    // streams: everything but the positions when they have their own buffer
+    unsigned int m_vao = 0;
+    unsigned int m_depthVao = 0;
+    unsigned int m_vbo = 0;
+    unsigned int m_positionVbo = 0;
+    unsigned int m_ebo = 0;
+
+    unsigned int m_attributes = 0;
+    bool         m_packed = false;
+    bool         m_positionStream = false;
+};
+
+//////////////////// IMPLEMENTATION ////////////////////
+
+inline MeshBuffer& MeshBuffer::operator=(MeshBuffer&& other) noexcept
+{
+    if (this != &other)
+    {
+        release();
+        m_vao            = std::exchange(other.m_vao, 0u);
+        m_depthVao       = std::exchange(other.m_depthVao, 0u);
+        m_vbo            = std::exchange(other.m_vbo, 0u);
+        m_positionVbo    = std::exchange(other.m_positionVbo, 0u);
+        m_ebo            = std::exchange(other.m_ebo, 0u);
+        m_attributes     = other.m_attributes;
+        m_packed         = other.m_packed;
+        m_positionStream = other.m_positionStream;
+    }
+    return *this;
+}
+
+inline void MeshBuffer::release()
+{
+    // deleting name 0 is a no-op
+    const unsigned int arrays[] = { m_vao, m_depthVao };
+    const unsigned int buffers[] = { m_vbo, m_positionVbo, m_ebo };
+    if (m_vao)
+    {
+        glDeleteVertexArrays(2, arrays);
+        glDeleteBuffers(3, buffers);
+    }
+    m_vao = m_depthVao = m_vbo = m_positionVbo = m_ebo = 0;
+}
+
+inline void MeshBuffer::allocate(const std::vector<MeshSource>& sources, const unsigned int attributes, const bool packed, const bool positionStream,
+                                 std::vector<DrawRange>& ranges)
+{
+    release();
+
+    unsigned int present = 0;
+    for (const MeshSource& source : sources)
+        present |= source.attributes;
+
+    m_attributes = (attributes & present) | (1u << ePOSITION);
+    m_packed = packed;
+    m_positionStream = positionStream;
+
+    // ranges back to back, index blocks 4 byte aligned so 16 and 32 bit ranges can mix
+    ranges.assign(sources.size(), DrawRange());
+    size_t vertexCount = 0, indexBytes = 0;
+    for (size_t i = 0; i < sources.size(); ++i)
+    {
+        DrawRange& range = ranges[i];
+        range.vertexCount = (GLsizei)sources[i].vertexCount;
+        range.baseVertex  = (GLint)vertexCount;
+        range.indexCount  = (GLsizei)sources[i].indexCount;
+        range.indexType   = indexType(sources[i].vertexCount);
+        range.indexOffset = indexBytes;
+
+        vertexCount += sources[i].vertexCount;
+        indexBytes  += (sources[i].indexCount * indexSize(range.indexType) + 3) & ~(size_t)3;
+    }
+
+    const VertexLayout positions(1u << ePOSITION, m_packed);
+    const VertexLayout layout(m_positionStream ? m_attributes & ~(1u << ePOSITION) : m_attributes, m_packed);
+
+    glGenVertexArrays(1, &m_vao);
+    glGenBuffers(1, &m_ebo);
+    glBindVertexArray(m_vao);
+    if (m_positionStream)
+    {
+        glGenBuffers(1, &m_positionVbo);
+        glBindBuffer(GL_ARRAY_BUFFER, m_positionVbo);
+        glBufferData(GL_ARRAY_BUFFER, vertexCount * positions.stride(), nullptr, GL_STATIC_DRAW);
+        positions.setupAttributes();
+    }
+    if (layout.attributes())
+    {
+        glGenBuffers(1, &m_vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
+        glBufferData(GL_ARRAY_BUFFER, vertexCount * layout.stride(), nullptr, GL_STATIC_DRAW);
+        layout.setupAttributes();
+    }
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBytes, nullptr, GL_STATIC_DRAW);
+
+    // depth only: the position stream and the same indices
+    if (m_positionStream)
+    {
+        glGenVertexArrays(1, &m_depthVao);
+        glBindVertexArray(m_depthVao);
+        glBindBuffer(GL_ARRAY_BUFFER, m_positionVbo);
+        positions.setupAttributes();
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ebo);
+    }
+
+    glBindVertexArray(0);
+}
+
+inline void MeshBuffer::upload(const MeshSource& source, DrawRange& range) const
+{
+    if (m_packed)
+        VertexPacker::bounds(source.vertices, source.vertexCount, range.positionOffset, range.positionScale);
+
+    // each stream interleaves its own attributes, the full float Vertex goes up as is
+    auto fill = [&](const unsigned int vbo, const VertexLayout& layout)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        const size_t offset = (size_t)range.baseVertex * layout.stride();
+        if (!m_packed && layout.stride() == sizeof(Vertex))
+            glBufferSubData(GL_ARRAY_BUFFER, offset, source.vertexCount * sizeof(Vertex), source.vertices);
+        else
+        {
+            std::vector<unsigned char> interleaved(source.vertexCount * layout.stride());
+            layout.write(source.vertices, source.vertexCount, range.positionOffset, range.positionScale, interleaved.data());
+            glBufferSubData(GL_ARRAY_BUFFER, offset, interleaved.size(), interleaved.data());
+        }
+    };
+
+    const VertexLayout layout(m_positionStream ? m_attributes & ~(1u << ePOSITION) : m_attributes, m_packed);
+    if (m_positionStream)
+        fill(m_positionVbo, VertexLayout(1u << ePOSITION, m_packed));
+    if (layout.attributes())
+        fill(m_vbo, layout);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    // the element array binding is vertex array state
+    glBindVertexArray(m_vao);
+    const size_t size = source.indexCount * indexSize(range.indexType);
+    if (source.indexType == range.indexType)
+        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, range.indexOffset, size, source.indices);
+    else
+    {
+        const uint32_t* wide = (const uint32_t*)source.indices;
+        const std::vector<uint16_t> narrow(wide, wide + source.indexCount);
+        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, range.indexOffset, size, narrow.data());
+    }
+    glBindVertexArray(0);
+}
+
+inline void MeshBuffer::create(const std::vector<MeshSource>& sources, const unsigned int attributes, const bool packed, const bool positionStream,
+                               std::vector<DrawRange>& ranges)
+{
+    allocate(sources, attributes, packed, positionStream, ranges);
+    for (size_t i = 0; i < sources.size(); ++i)
+        upload(sources[i], ranges[i]);
+}
+
+inline void MeshBuffer::draw(const DrawRange& range, const GLsizei instances)
+{
+    if (instances > 1)
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, range.indexCount, range.indexType, (const void*)range.indexOffset, instances, range.baseVertex);
+    else
+        glDrawElementsBaseVertex(GL_TRIANGLES, range.indexCount, range.indexType, (const void*)range.indexOffset, range.baseVertex);
+}
+
+} // namespace model
@@ -0,0 +1,655 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "model/mesh.h"
+#include "util/hash.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/*
+Binary mesh cache:
+
+    A warm start maps the cache file and uploads the vertex / index streams straight from the mapping,
+    Assimp is not involved at all.
+
+    * key = hash(source file bytes, bytes of the .mtl files an .obj names, import flags, cache version)
+    * a stale key, a different Vertex layout, a bad checksum or an out of range offset all reject the file,
+      the caller then imports with Assimp and rewrites the cache
+
+    Layout (native endian, all offsets from the start of the file):
+
+        Header
+        MeshRecord[meshCount]
+        TextureRecord[textureCount]     type / name of every texture binding, into the string table
+        NodeRecord[nodeCount]           pre-order, parent before children
+        uint32[nodeMeshCount]           mesh indices referenced by the nodes
+        Meshlet[meshletCount]           clusters of every mesh (ImportSettings::meshlets)
+        Lod[lodCount]                   levels of detail of every mesh, ranges of its indices (ImportSettings::lods)
+        char[stringSize]                string table
+        per mesh: Vertex[] then uint16[] or uint32[] indices (MeshRecord::indexSize), each block 16 byte aligned
+
+    Indices are stored 16 bit when the mesh has at most 65536 vertices (MeshBuffer::indexType()), so they upload as is.
+*/
+
+namespace model
+{
+namespace cache
+{
+
+const uint32_t VERSION = 7;
+const char MAGIC[4] = { 'O', 'G', 'L', 'C' };
+
+struct Header
+{
+    char     magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint32_t vertexSize;
+    uint32_t meshCount;
+    uint32_t textureCount;
+    uint32_t nodeCount;
+    uint32_t nodeMeshCount;
+    uint32_t meshletCount;
+    uint32_t stringSize;
+    uint32_t lodCount;
+    uint64_t fileSize;
+    uint64_t payloadHash; // everything after the header
+};
+
+struct MeshRecord
+{
+    uint64_t vertexOffset;
+    uint64_t indexOffset;
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t firstTexture;
+    uint32_t textureCount;
+    uint32_t indexSize; // 2 or 4
+    uint32_t attributes; // MeshData::attributes
+    uint32_t firstMeshlet;
+    uint32_t meshletCount;
+    uint32_t firstLod;
+    uint32_t lodCount;
+    float    bounds[4]; // sphere center, radius
+    float    box[6];    // min, max
+};
+
+struct TextureRecord
+{
+    uint32_t typeOffset;
+    uint32_t typeLength;
+    uint32_t nameOffset;
+    uint32_t nameLength;
+};
+
+struct NodeRecord
+{
+    int32_t  parent;
+    uint32_t firstMesh;
+    uint32_t meshCount;
+    uint32_t pad;
+    float    transform[16];
+};
+
+// node of the imported hierarchy
+struct Node
+{
+    int parent;
+    glm::mat4 transform;
+    std::vector<unsigned int> meshes; // index into the mesh table
+};
+
+// read only view of a whole file
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+
+    bool open(const std::string& path);
+    void close();
+
+    const unsigned char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+private:
+    const unsigned char* m_data = nullptr;
+    size_t m_size = 0;
+#ifdef _WIN32
+    HANDLE m_file = INVALID_HANDLE_VALUE;
+    HANDLE m_mapping = nullptr;
+#endif
+};
+
+// validated cache file
+class CacheFile
+{
+public:
+    bool open(const std::string& path, const uint64_t key);
+
+    unsigned int meshCount() const { return m_header->meshCount; }
+    const MeshRecord& mesh(const unsigned int i) const { return m_meshes[i]; }
+    const Vertex* vertices(const unsigned int i) const { return (const Vertex*)(m_file.data() + m_meshes[i].vertexOffset); }
+    // uint16 or uint32, see indexType()
+    const void* indices(const unsigned int i) const { return m_file.data() + m_meshes[i].indexOffset; }
+    GLenum indexType(const unsigned int i) const { return m_meshes[i].indexSize == sizeof(uint16_t) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT; }
+
+    std::string textureType(const unsigned int t) const { return std::string(m_strings + m_textures[t].typeOffset, m_textures[t].typeLength); }
+    std::string textureName(const unsigned int t) const { return std::string(m_strings + m_textures[t].nameOffset, m_textures[t].nameLength); }
+
+    unsigned int nodeCount() const { return m_header->nodeCount; }
+    const NodeRecord& node(const unsigned int i) const { return m_nodes[i]; }
+    const uint32_t* nodeMeshes(const unsigned int i) const { return m_nodeMeshes + m_nodes[i].firstMesh; }
+
+    const Meshlet* meshlets(const unsigned int i) const { return m_meshlets + m_meshes[i].firstMeshlet; }
+    const Lod* lods(const unsigned int i) const { return m_lods + m_meshes[i].firstLod; }
+    // bounds, meshlets and levels of mesh [i]
+    MeshDetail detail(const unsigned int i) const;
+
+private:
+    bool validate(const uint64_t key);
+
+private:
+    MappedFile m_file;
+
+    const Header*        m_header = nullptr;
+    const MeshRecord*    m_meshes = nullptr;
+    const TextureRecord* m_textures = nullptr;
+    const NodeRecord*    m_nodes = nullptr;
+    const uint32_t*      m_nodeMeshes = nullptr;
+    const Meshlet*       m_meshlets = nullptr;
+    const Lod*           m_lods = nullptr;
+    const char*          m_strings = nullptr;
+};
+
+// hash of the source file, the material libraries an .obj names (mtllib) and the import flags,
+// false if the source file can't be read
+bool sourceKey(const std::string& path, const unsigned int importFlags, uint64_t& key);
+
+bool write(const std::string& path, const uint64_t key, const std::vector<MeshData>& meshes, const std::vector<Node>& nodes);
+// copies the cache into memory, for loaders that can't upload straight from the mapping
+bool read(const std::string& path, const uint64_t key, std::vector<MeshData>& meshes, std::vector<Node>& nodes);
+
+//////////////////// IMPLEMENTATION ////////////////////
+
+inline size_t alignUp(const size_t value, const size_t alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+inline bool sourceKey(const std::string& path, const unsigned int importFlags, uint64_t& key)
+{
+    MappedFile source;
+    if (!source.open(path))
+        return false;
+
+    key = util::hash(source.data(), source.size());
+
+    // texture bindings come from the .mtl, editing it has to invalidate the cache as well
+    const size_t dot = path.find_last_of('.');
+    std::string extension = dot == std::string::npos ? "" : path.substr(dot + 1);
+    for (char& c : extension)
+        c = (char)std::tolower((unsigned char)c);
+    if (extension == "obj")
+    {
+        const size_t slash = path.find_last_of("/\\");
+        const std::string directory = slash == std::string::npos ? "" : path.substr(0, slash + 1);
+
+        const char* text = (const char*)source.data();
+        const char* end = text + source.size();
+        while (text < end)
+        {
+            const char* line = text;
+            while (text < end && *text != '\n')
+                ++text;
+            const char* next = text < end ? text + 1 : text;
+
+            while (line < text && (*line == ' ' || *line == '\t'))
+                ++line;
+            if (text - line > 7 && std::strncmp(line, "mtllib", 6) == 0 && (line[6] == ' ' || line[6] == '\t'))
+            {
+                // the rest of the line is the file name, as Assimp reads it
+                const char* first = line + 7;
+                const char* last = text;
+                while (first < last && (*first == ' ' || *first == '\t'))
+                    ++first;
+                while (last > first && (last[-1] == ' ' || last[-1] == '\t' || last[-1] == '\r'))
+                    --last;
+                const std::string name(first, last);
+
+                key = util::hash(name.data(), name.size(), key);
+                MappedFile library;
+                if (library.open(directory + name))
+                    key = util::hash(library.data(), library.size(), key);
+            }
+            text = next;
+        }
+    }
+
+    key = util::hash(&importFlags, sizeof(importFlags), key);
+    key = util::hash(&VERSION, sizeof(VERSION), key);
+    return true;
+}
+
+#ifdef _WIN32
+
+inline bool MappedFile::open(const std::string& path)
+{
+    close();
+
+    m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (m_file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(m_file, &size) || size.QuadPart == 0)
+    {
+        close();
+        return false;
+    }
+
+    m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (m_mapping)
+        m_data = (const unsigned char*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!m_data)
+    {
+        close();
+        return false;
+    }
+
+    m_size = (size_t)size.QuadPart;
+    return true;
+}
+
+inline void MappedFile::close()
+{
+    if (m_data)
+        UnmapViewOfFile(m_data);
+    if (m_mapping)
+        CloseHandle(m_mapping);
+    if (m_file != INVALID_HANDLE_VALUE)
+        CloseHandle(m_file);
+
+    m_data = nullptr;
+    m_size = 0;
+    m_mapping = nullptr;
+    m_file = INVALID_HANDLE_VALUE;
+}
+
+#else
+
+inline bool MappedFile::open(const std::string& path)
+{
+    close();
+
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    // the mapping stays valid after the descriptor is closed
+    void* data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+        return false;
+
+    m_data = (const unsigned char*)data;
+    m_size = (size_t)st.st_size;
+    return true;
+}
+
+inline void MappedFile::close()
+{
+    if (m_data)
+        munmap((void*)m_data, m_size);
+
+    m_data = nullptr;
+    m_size = 0;
+}
+
+#endif
+
+inline bool CacheFile::open(const std::string& path, const uint64_t key)
+{
+    if (!m_file.open(path))
+        return false;
+
+    if (!validate(key))
+    {
+        m_file.close();
+        return false;
+    }
+    return true;
+}
+
+inline MeshDetail CacheFile::detail(const unsigned int i) const
+{
+    const MeshRecord& record = m_meshes[i];
+    MeshDetail detail;
+    detail.bounds.center = glm::make_vec3(record.bounds);
+    detail.bounds.radius = record.bounds[3];
+    detail.box.min = glm::make_vec3(record.box);
+    detail.box.max = glm::make_vec3(record.box + 3);
+    detail.meshlets.assign(meshlets(i), meshlets(i) + record.meshletCount);
+    detail.lods.assign(lods(i), lods(i) + record.lodCount);
+    return detail;
+}
+
+inline bool CacheFile::validate(const uint64_t key)
+{
+    const unsigned char* base = m_file.data();
+    const size_t size = m_file.size();
+
+    if (size < sizeof(Header))
+        return false;
+
+    m_header = (const Header*)base;
+    if (std::memcmp(m_header->magic, MAGIC, sizeof(MAGIC)) != 0 ||
+        m_header->version != VERSION ||
+        m_header->vertexSize != sizeof(Vertex) ||
+        m_header->fileSize != size)
+        return false;
+
+    // the source changed since the cache was written
+    if (m_header->key != key)
+        return false;
+
+    if (util::hash(base + sizeof(Header), size - sizeof(Header)) != m_header->payloadHash)
+    {
+        std::cout << "ERROR::CACHE:: checksum mismatch" << std::endl;
+        return false;
+    }
+
+    // tables
+    size_t offset = sizeof(Header);
+    auto table = [&](const size_t count, const size_t stride) -> const unsigned char*
+    {
+        const size_t begin = offset;
+        if (count > (size - begin) / stride)
+            return nullptr;
+        offset += count * stride;
+        return base + begin;
+    };
+
+    m_meshes     = (const MeshRecord*)table(m_header->meshCount, sizeof(MeshRecord));
+    m_textures   = (const TextureRecord*)table(m_header->textureCount, sizeof(TextureRecord));
+    m_nodes      = (const NodeRecord*)table(m_header->nodeCount, sizeof(NodeRecord));
+    m_nodeMeshes = (const uint32_t*)table(m_header->nodeMeshCount, sizeof(uint32_t));
+    m_meshlets   = (const Meshlet*)table(m_header->meshletCount, sizeof(Meshlet));
+    m_lods       = (const Lod*)table(m_header->lodCount, sizeof(Lod));
+    m_strings    = (const char*)table(m_header->stringSize, 1);
+    if (!m_meshes || !m_textures || !m_nodes || !m_nodeMeshes || !m_meshlets || !m_lods || !m_strings)
+        return false;
+
+    // every reference has to stay inside the file
+    auto inside = [size](const uint64_t begin, const uint64_t count, const uint64_t stride)
+    {
+        return begin % 16 == 0 && begin <= size && count <= (size - begin) / stride;
+    };
+    for (unsigned int i = 0; i < m_header->meshCount; ++i)
+    {
+        const MeshRecord& mesh = m_meshes[i];
+        if ((mesh.indexSize != sizeof(uint16_t) && mesh.indexSize != sizeof(uint32_t)) ||
+            !inside(mesh.vertexOffset, mesh.vertexCount, sizeof(Vertex)) ||
+            !inside(mesh.indexOffset, mesh.indexCount, mesh.indexSize) ||
+            mesh.firstTexture > m_header->textureCount ||
+            mesh.textureCount > m_header->textureCount - mesh.firstTexture ||
+            mesh.firstMeshlet > m_header->meshletCount ||
+            mesh.meshletCount > m_header->meshletCount - mesh.firstMeshlet ||
+            mesh.firstLod > m_header->lodCount ||
+            mesh.lodCount > m_header->lodCount - mesh.firstLod)
+            return false;
+
+        for (uint32_t j = 0; j < mesh.lodCount; ++j)
+        {
+            const Lod& lod = m_lods[mesh.firstLod + j];
+            if (lod.firstIndex > mesh.indexCount || lod.indexCount > mesh.indexCount - lod.firstIndex)
+                return false;
+        }
+        // meshlets cover level 0 only
+        const uint32_t baseCount = mesh.lodCount ? m_lods[mesh.firstLod].indexCount : mesh.indexCount;
+        for (uint32_t j = 0; j < mesh.meshletCount; ++j)
+        {
+            const Meshlet& meshlet = m_meshlets[mesh.firstMeshlet + j];
+            if (meshlet.firstIndex > baseCount || meshlet.indexCount > baseCount - meshlet.firstIndex)
+                return false;
+        }
+    }
+    for (unsigned int t = 0; t < m_header->textureCount; ++t)
+    {
+        const TextureRecord& texture = m_textures[t];
+        if (texture.typeOffset > m_header->stringSize || texture.typeLength > m_header->stringSize - texture.typeOffset ||
+            texture.nameOffset > m_header->stringSize || texture.nameLength > m_header->stringSize - texture.nameOffset)
+            return false;
+    }
+    for (unsigned int i = 0; i < m_header->nodeCount; ++i)
+    {
+        const NodeRecord& node = m_nodes[i];
+        // -1 for a root, otherwise a node written before this one
+        if (node.parent < -1 || node.parent >= (int32_t)i ||
+            node.firstMesh > m_header->nodeMeshCount ||
+            node.meshCount > m_header->nodeMeshCount - node.firstMesh)
+            return false;
+
+        for (uint32_t j = 0; j < node.meshCount; ++j)
+            if (m_nodeMeshes[node.firstMesh + j] >= m_header->meshCount)
+                return false;
+    }
+    return true;
+}
+
+inline bool write(const std::string& path, const uint64_t key, const std::vector<MeshData>& meshes, const std::vector<Node>& nodes)
+{
+    std::vector<MeshRecord>    meshTable;
+    std::vector<TextureRecord> textureTable;
+    std::vector<NodeRecord>    nodeTable;
+    std::vector<uint32_t>      nodeMeshes;
+    std::vector<Meshlet>       meshletTable;
+    std::vector<Lod>           lodTable;
+    std::string                strings;
+
+    auto addString = [&strings](const std::string& str, uint32_t& offset, uint32_t& length)
+    {
+        offset = (uint32_t)strings.size();
+        length = (uint32_t)str.size();
+        strings += str;
+    };
+
+    for (const MeshData& mesh : meshes)
+    {
+        MeshRecord record = {};
+        record.vertexCount  = (uint32_t)mesh.vertices.size();
+        record.indexCount   = (uint32_t)mesh.indices.size();
+        record.indexSize    = (uint32_t)MeshBuffer::indexSize(MeshBuffer::indexType(mesh.vertices.size()));
+        record.firstTexture = (uint32_t)textureTable.size();
+        record.textureCount = (uint32_t)mesh.textures.size();
+        record.attributes   = mesh.attributes;
+        record.firstMeshlet = (uint32_t)meshletTable.size();
+        record.meshletCount = (uint32_t)mesh.detail.meshlets.size();
+        record.firstLod     = (uint32_t)lodTable.size();
+        record.lodCount     = (uint32_t)mesh.detail.lods.size();
+        std::memcpy(record.bounds, &mesh.detail.bounds.center[0], 3 * sizeof(float));
+        record.bounds[3]    = mesh.detail.bounds.radius;
+        std::memcpy(record.box, &mesh.detail.box.min[0], 3 * sizeof(float));
+        std::memcpy(record.box + 3, &mesh.detail.box.max[0], 3 * sizeof(float));
+        meshTable.push_back(record);
+        meshletTable.insert(meshletTable.end(), mesh.detail.meshlets.begin(), mesh.detail.meshlets.end());
+        lodTable.insert(lodTable.end(), mesh.detail.lods.begin(), mesh.detail.lods.end());
+
+        for (const Texture& texture : mesh.textures)
+        {
+            TextureRecord tex;
+            addString(texture.type, tex.typeOffset, tex.typeLength);
+            addString(texture.name, tex.nameOffset, tex.nameLength);
+            textureTable.push_back(tex);
+        }
+    }
+
+    for (const Node& node : nodes)
+    {
+        NodeRecord record = {};
+        record.parent    = node.parent;
+        record.firstMesh = (uint32_t)nodeMeshes.size();
+        record.meshCount = (uint32_t)node.meshes.size();
+        std::memcpy(record.transform, &node.transform[0][0], sizeof(record.transform));
+        nodeTable.push_back(record);
+
+        nodeMeshes.insert(nodeMeshes.end(), node.meshes.begin(), node.meshes.end());
+    }
+
+    // data blocks follow the tables
+    size_t offset = sizeof(Header)
+                  + meshTable.size() * sizeof(MeshRecord)
+                  + textureTable.size() * sizeof(TextureRecord)
+                  + nodeTable.size() * sizeof(NodeRecord)
+                  + nodeMeshes.size() * sizeof(uint32_t)
+                  + meshletTable.size() * sizeof(Meshlet)
+                  + lodTable.size() * sizeof(Lod)
+                  + strings.size();
+    for (size_t i = 0; i < meshes.size(); ++i)
+    {
+        offset = alignUp(offset, 16);
+        meshTable[i].vertexOffset = offset;
+        offset += meshes[i].vertices.size() * sizeof(Vertex);
+
+        offset = alignUp(offset, 16);
+        meshTable[i].indexOffset = offset;
+        offset += meshes[i].indices.size() * meshTable[i].indexSize;
+    }
+
+    // assemble in memory, the checksum needs the whole payload anyway
+    std::vector<unsigned char> file(alignUp(offset, 16), 0);
+    size_t cursor = sizeof(Header);
+    auto put = [&file, &cursor](const void* data, const size_t size)
+    {
+        if (size)
+            std::memcpy(file.data() + cursor, data, size);
+        cursor += size;
+    };
+    put(meshTable.data(), meshTable.size() * sizeof(MeshRecord));
+    put(textureTable.data(), textureTable.size() * sizeof(TextureRecord));
+    put(nodeTable.data(), nodeTable.size() * sizeof(NodeRecord));
+    put(nodeMeshes.data(), nodeMeshes.size() * sizeof(uint32_t));
+    put(meshletTable.data(), meshletTable.size() * sizeof(Meshlet));
+    put(lodTable.data(), lodTable.size() * sizeof(Lod));
+    put(strings.data(), strings.size());
+    for (size_t i = 0; i < meshes.size(); ++i)
+    {
+        cursor = meshTable[i].vertexOffset;
+        put(meshes[i].vertices.data(), meshes[i].vertices.size() * sizeof(Vertex));
+        cursor = meshTable[i].indexOffset;
+        if (meshTable[i].indexSize == sizeof(uint16_t))
+        {
+            const std::vector<uint16_t> narrow = Mesh::narrowIndices(meshes[i].indices);
+            put(narrow.data(), narrow.size() * sizeof(uint16_t));
+        }
+        else
+            put(meshes[i].indices.data(), meshes[i].indices.size() * sizeof(uint32_t));
+    }
+
+    Header header = {};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version       = VERSION;
+    header.key           = key;
+    header.vertexSize    = sizeof(Vertex);
+    header.meshCount     = (uint32_t)meshTable.size();
+    header.textureCount  = (uint32_t)textureTable.size();
+    header.nodeCount     = (uint32_t)nodeTable.size();
+    header.nodeMeshCount = (uint32_t)nodeMeshes.size();
+    header.meshletCount  = (uint32_t)meshletTable.size();
+    header.lodCount      = (uint32_t)lodTable.size();
+    header.stringSize    = (uint32_t)strings.size();
+    header.fileSize      = file.size();
+    header.payloadHash   = util::hash(file.data() + sizeof(Header), file.size() - sizeof(Header));
+    std::memcpy(file.data(), &header, sizeof(Header));
+
+    // write aside and swap, a crash never leaves a half written cache behind
+    const std::string tmpPath = path + ".tmp";
+    {
+        std::ofstream os(tmpPath, std::ios::binary | std::ios::trunc);
+        os.write((const char*)file.data(), file.size());
+        if (!os)
+        {
+            std::cout << "ERROR::CACHE:: failed to write " << tmpPath << std::endl;
+            return false;
+        }
+    }
+    std::remove(path.c_str());
+    if (std::rename(tmpPath.c_str(), path.c_str()) != 0)
+    {
+        std::remove(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+inline bool read(const std::string& path, const uint64_t key, std::vector<MeshData>& meshes, std::vector<Node>& nodes)
+{
+    CacheFile file;
+    if (!file.open(path, key))
+        return false;
+
+    meshes.resize(file.meshCount());
+    for (unsigned int i = 0; i < file.meshCount(); ++i)
+    {
+        const MeshRecord& record = file.mesh(i);
+        meshes[i].vertices.assign(file.vertices(i), file.vertices(i) + record.vertexCount);
+        if (file.indexType(i) == GL_UNSIGNED_SHORT)
+        {
+            const uint16_t* indices = (const uint16_t*)file.indices(i);
+            meshes[i].indices.assign(indices, indices + record.indexCount);
+        }
+        else
+        {
+            const uint32_t* indices = (const uint32_t*)file.indices(i);
+            meshes[i].indices.assign(indices, indices + record.indexCount);
+        }
+        meshes[i].textures.clear();
+        for (unsigned int t = record.firstTexture; t < record.firstTexture + record.textureCount; ++t)
+            meshes[i].textures.push_back({ 0, file.textureType(t), file.textureName(t) });
+        meshes[i].attributes = record.attributes;
+        meshes[i].detail = file.detail(i);
+    }
+
+    nodes.resize(file.nodeCount());
+    for (unsigned int n = 0; n < file.nodeCount(); ++n)
+    {
+        const NodeRecord& record = file.node(n);
+        nodes[n].parent = record.parent;
+        nodes[n].transform = glm::make_mat4(record.transform);
+        nodes[n].meshes.assign(file.nodeMeshes(n), file.nodeMeshes(n) + record.meshCount);
+    }
+    return true;
+}
+
+} // namespace cache
+} // namespace model
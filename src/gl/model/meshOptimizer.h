@@ -0,0 +1,387 @@
+#pragma once
+
+#include "model/mesh.h"
+#include "util/hash.h"
+#include "util/threadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+/*
+Mesh optimization passes, cpu only, run on the import threads:
+
+    * weld: Assimp's OBJ importer emits one vertex per face corner. Vertices whose attributes fall in the same
+      epsilon sized cell are merged into the first of them and the indices are rewritten.
+      epsilon 0 welds bit identical vertices only.
+    * optimizeVertexCache: Forsyth's greedy triangle order for the post-transform cache (lru of 32 scored entries)
+    * optimizeVertexFetch: vertices renumbered in the order the triangles first use them, unused ones dropped
+    * analyzeVertexCache: FIFO cache simulation, ACMR = misses per triangle, ATVR = misses per vertex
+    * computeTangents: per vertex tangent frame from the uv gradients of its triangles, replaces Assimp's
+      aiProcess_CalcTangentSpace so it only runs for meshes that sample a normal map. Run after weld: welded
+      vertices average the faces around them, uv seams keep their own frames
+*/
+
+namespace model
+{
+
+class MeshOptimizer
+{
+public:
+    // returns the number of vertices left
+    static size_t weld(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices, const float epsilon);
+
+    static void optimizeVertexCache(std::vector<unsigned int>& indices, const size_t vertexCount);
+    static void optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices);
+
+    struct CacheStats
+    {
+        size_t misses = 0;
+        size_t triangles = 0;
+        size_t vertices = 0;
+
+        float acmr() const { return triangles ? (float)misses / triangles : 0.0f; }
+        float atvr() const { return vertices ? (float)misses / vertices : 0.0f; }
+        CacheStats& operator+=(const CacheStats& other);
+    };
+    static CacheStats analyzeVertexCache(const std::vector<unsigned int>& indices, const size_t vertexCount, const unsigned int cacheSize = 16);
+
+    // needs normals and uvs, fills Tangent and Bitangent
+    static void computeTangents(std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices);
+
+private:
+    // position, normal, uv, tangent, bitangent. Bone data is not filled by processMesh and is ignored
+    static const int WELD_FIELDS = 14;
+    static void weldKey(const Vertex& vertex, const float epsilon, int64_t* key);
+
+    static const int FORSYTH_CACHE = 32;
+    static float forsythScore(const int cachePosition, const unsigned int valence);
+};
+
+//////////////////// IMPLEMENTATION ////////////////////
+
+inline void MeshOptimizer::weldKey(const Vertex& vertex, const float epsilon, int64_t* key)
+{
+    const float fields[WELD_FIELDS] = {
+        vertex.Position.x,  vertex.Position.y,  vertex.Position.z,
+        vertex.Normal.x,    vertex.Normal.y,    vertex.Normal.z,
+        vertex.TexCoords.x, vertex.TexCoords.y,
+        vertex.Tangent.x,   vertex.Tangent.y,   vertex.Tangent.z,
+        vertex.Bitangent.x, vertex.Bitangent.y, vertex.Bitangent.z };
+
+    // quotients llround can't represent (a tiny epsilon, inf, nan) weld bit identical values only. Their keys
+    // live below every quantized one, so the two kinds never meet
+    const double LIMIT = 4611686018427387904.0; // 2^62
+    for (int i = 0; i < WELD_FIELDS; ++i)
+    {
+        const double quotient = epsilon > 0.0f ? (double)fields[i] / epsilon : 0.0;
+        if (epsilon > 0.0f && std::fabs(quotient) < LIMIT)
+            key[i] = std::llround(quotient);
+        else
+        {
+            // -0 and 0 are one value
+            const float value = fields[i] == 0.0f ? 0.0f : fields[i];
+            uint32_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            key[i] = epsilon > 0.0f ? INT64_MIN + (int64_t)bits : (int32_t)bits;
+        }
+    }
+}
+
+inline size_t MeshOptimizer::weld(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices, const float epsilon)
+{
+    const size_t count = vertices.size();
+    if (count < 2)
+        return count;
+
+    util::ThreadPool& pool = util::defaultPool();
+    const size_t CHUNK = 4096;
+    const size_t chunks = (count + CHUNK - 1) / CHUNK;
+
+    // quantized attributes and their hash
+    std::vector<int64_t>  keys(count * WELD_FIELDS);
+    std::vector<uint64_t> hashes(count);
+    pool.parallelFor(chunks, [&](const size_t chunk)
+    {
+        const size_t end = std::min(count, (chunk + 1) * CHUNK);
+        for (size_t i = chunk * CHUNK; i < end; ++i)
+        {
+            int64_t* key = &keys[i * WELD_FIELDS];
+            weldKey(vertices[i], epsilon, key);
+            hashes[i] = util::hash(key, WELD_FIELDS * sizeof(int64_t));
+        }
+    });
+
+    // shards by hash: each one sees all candidates of its vertices, in ascending order, so the first
+    // vertex of a group is always its representative and the result doesn't depend on scheduling
+    std::vector<uint32_t> remap(count);
+    const size_t shards = (size_t)pool.size() + 1;
+    pool.parallelFor(shards, [&](const size_t shard)
+    {
+        std::unordered_map<uint64_t, uint32_t> first;
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (hashes[i] % shards != shard)
+                continue;
+
+            remap[i] = (uint32_t)i;
+            auto inserted = first.emplace(hashes[i], (uint32_t)i);
+            if (inserted.second)
+                continue;
+
+            // a hash collision between different vertices keeps both
+            const uint32_t candidate = inserted.first->second;
+            if (std::equal(&keys[i * WELD_FIELDS], &keys[(i + 1) * WELD_FIELDS], &keys[(size_t)candidate * WELD_FIELDS]))
+                remap[i] = candidate;
+        }
+    });
+
+    // compact, first occurrences keep their relative order
+    std::vector<uint32_t> newIndex(count);
+    size_t unique = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (remap[i] == i)
+        {
+            newIndex[i] = (uint32_t)unique;
+            vertices[unique++] = vertices[i];
+        }
+        else
+            newIndex[i] = newIndex[remap[i]];
+    }
+    vertices.resize(unique);
+    vertices.shrink_to_fit();
+
+    const size_t indexChunks = (indices.size() + CHUNK - 1) / CHUNK;
+    pool.parallelFor(indexChunks, [&](const size_t chunk)
+    {
+        const size_t end = std::min(indices.size(), (chunk + 1) * CHUNK);
+        for (size_t i = chunk * CHUNK; i < end; ++i)
+            indices[i] = newIndex[indices[i]];
+    });
+
+    return unique;
+}
+
+inline MeshOptimizer::CacheStats& MeshOptimizer::CacheStats::operator+=(const CacheStats& other)
+{
+    misses    += other.misses;
+    triangles += other.triangles;
+    vertices  += other.vertices;
+    return *this;
+}
+
+inline MeshOptimizer::CacheStats MeshOptimizer::analyzeVertexCache(const std::vector<unsigned int>& indices, const size_t vertexCount, const unsigned int cacheSize)
+{
+    CacheStats stats;
+    stats.triangles = indices.size() / 3;
+    stats.vertices  = vertexCount;
+
+    // FIFO: a vertex stays until cacheSize misses later
+    std::vector<size_t> loadedAt(vertexCount, 0);
+    for (const unsigned int index : indices)
+    {
+        if (loadedAt[index] == 0 || stats.misses - loadedAt[index] >= cacheSize)
+        {
+            ++stats.misses;
+            loadedAt[index] = stats.misses;
+        }
+    }
+    return stats;
+}
+
+inline void MeshOptimizer::computeTangents(std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices)
+{
+    std::vector<glm::vec3> tangents(vertices.size(), glm::vec3(0.0f));
+    std::vector<glm::vec3> bitangents(vertices.size(), glm::vec3(0.0f));
+
+    for (size_t t = 0; t + 2 < indices.size(); t += 3)
+    {
+        const Vertex& v0 = vertices[indices[t]];
+        const Vertex& v1 = vertices[indices[t + 1]];
+        const Vertex& v2 = vertices[indices[t + 2]];
+
+        const glm::vec3 e1 = v1.Position - v0.Position;
+        const glm::vec3 e2 = v2.Position - v0.Position;
+        const glm::vec2 d1 = v1.TexCoords - v0.TexCoords;
+        const glm::vec2 d2 = v2.TexCoords - v0.TexCoords;
+        const float det = d1.x * d2.y - d2.x * d1.y;
+        if (std::fabs(det) < 1e-12f)
+            continue; // degenerate uvs
+
+        // not normalized: larger triangles weigh more
+        const float r = 1.0f / det;
+        const glm::vec3 tangent   = (e1 * d2.y - e2 * d1.y) * r;
+        const glm::vec3 bitangent = (e2 * d1.x - e1 * d2.x) * r;
+        for (int k = 0; k < 3; ++k)
+        {
+            tangents[indices[t + k]]   += tangent;
+            bitangents[indices[t + k]] += bitangent;
+        }
+    }
+
+    for (size_t i = 0; i < vertices.size(); ++i)
+    {
+        Vertex& vertex = vertices[i];
+        const glm::vec3 n = vertex.Normal;
+
+        // Gram-Schmidt against the normal, any perpendicular axis when the uvs gave nothing
+        glm::vec3 tangent = tangents[i] - n * glm::dot(n, tangents[i]);
+        if (glm::dot(tangent, tangent) < 1e-20f)
+        {
+            const glm::vec3 axis = std::fabs(n.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+            tangent = axis - n * glm::dot(n, axis);
+        }
+        tangent = glm::normalize(tangent);
+
+        // keep the handedness of the uv mapping
+        const float handedness = glm::dot(glm::cross(n, tangent), bitangents[i]) < 0.0f ? -1.0f : 1.0f;
+        vertex.Tangent   = tangent;
+        vertex.Bitangent = glm::cross(n, tangent) * handedness;
+    }
+}
+
+inline float MeshOptimizer::forsythScore(const int cachePosition, const unsigned int valence)
+{
+    if (valence == 0)
+        return -1.0f; // no triangles left
+
+    float score = 0.0f;
+    if (cachePosition >= 0)
+    {
+        // the last triangle's vertices score a fixed value so the next one doesn't reuse them too eagerly
+        if (cachePosition < 3)
+            score = 0.75f;
+        else
+            score = std::pow(1.0f - (float)(cachePosition - 3) / (FORSYTH_CACHE - 3), 1.5f);
+    }
+    // finish off vertices with few triangles left
+    return score + 2.0f / std::sqrt((float)valence);
+}
+
+inline void MeshOptimizer::optimizeVertexCache(std::vector<unsigned int>& indices, const size_t vertexCount)
+{
+    const size_t triangleCount = indices.size() / 3;
+    if (triangleCount < 2)
+        return;
+
+    // vertex -> triangles, compact adjacency
+    std::vector<unsigned int> valence(vertexCount, 0);
+    for (const unsigned int index : indices)
+        ++valence[index];
+    std::vector<unsigned int> firstTriangle(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; ++v)
+        firstTriangle[v + 1] = firstTriangle[v] + valence[v];
+    std::vector<unsigned int> adjacency(indices.size());
+    {
+        std::vector<unsigned int> fill(firstTriangle.begin(), firstTriangle.end() - 1);
+        for (size_t i = 0; i < indices.size(); ++i)
+            adjacency[fill[indices[i]]++] = (unsigned int)(i / 3);
+    }
+
+    std::vector<int>   cachePosition(vertexCount, -1);
+    std::vector<float> vertexScore(vertexCount);
+    for (size_t v = 0; v < vertexCount; ++v)
+        vertexScore[v] = forsythScore(-1, valence[v]);
+
+    std::vector<float> triangleScore(triangleCount);
+    std::vector<char>  emitted(triangleCount, 0);
+    size_t best = 0;
+    for (size_t t = 0; t < triangleCount; ++t)
+    {
+        triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+        if (triangleScore[t] > triangleScore[best])
+            best = t;
+    }
+
+    std::vector<unsigned int> output;
+    output.reserve(indices.size());
+    std::vector<unsigned int> cache, next;
+    cache.reserve(FORSYTH_CACHE + 3);
+    next.reserve(FORSYTH_CACHE + 3);
+    size_t cursor = 0; // linear scan fallback when the cache has nothing left to offer
+
+    for (size_t emittedCount = 0; emittedCount < triangleCount; ++emittedCount)
+    {
+        if (emitted[best])
+        {
+            while (emitted[cursor])
+                ++cursor;
+            best = cursor;
+        }
+
+        const unsigned int* triangle = &indices[best * 3];
+        emitted[best] = 1;
+        output.insert(output.end(), triangle, triangle + 3);
+
+        // remove the triangle from its vertices' adjacency
+        for (int k = 0; k < 3; ++k)
+        {
+            const unsigned int v = triangle[k];
+            unsigned int* begin = &adjacency[firstTriangle[v]];
+            unsigned int* end = begin + valence[v];
+            std::iter_swap(std::find(begin, end, (unsigned int)best), end - 1);
+            --valence[v];
+        }
+
+        // new lru order: this triangle first, then the old entries
+        next.assign(triangle, triangle + 3);
+        for (const unsigned int v : cache)
+        {
+            if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+                next.push_back(v);
+        }
+        for (size_t i = 0; i < next.size(); ++i)
+            cachePosition[next[i]] = i < (size_t)FORSYTH_CACHE ? (int)i : -1;
+
+        // rescore what moved and pick the best triangle around it
+        float bestScore = -1.0f;
+        for (const unsigned int v : next)
+        {
+            const float score = forsythScore(cachePosition[v], valence[v]);
+            const float delta = score - vertexScore[v];
+            vertexScore[v] = score;
+
+            for (unsigned int i = 0; i < valence[v]; ++i)
+            {
+                const unsigned int t = adjacency[firstTriangle[v] + i];
+                triangleScore[t] += delta;
+                if (triangleScore[t] > bestScore)
+                {
+                    bestScore = triangleScore[t];
+                    best = t;
+                }
+            }
+        }
+
+        if (next.size() > (size_t)FORSYTH_CACHE)
+            next.resize(FORSYTH_CACHE);
+        cache.swap(next);
+    }
+
+    indices.swap(output);
+}
+
+inline void MeshOptimizer::optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices)
+{
+    const unsigned int UNUSED = ~0u;
+    std::vector<unsigned int> remap(vertices.size(), UNUSED);
+    std::vector<Vertex> ordered;
+    ordered.reserve(vertices.size());
+
+    for (unsigned int& index : indices)
+    {
+        if (remap[index] == UNUSED)
+        {
+            remap[index] = (unsigned int)ordered.size();
+            ordered.push_back(vertices[index]);
+        }
+        index = remap[index];
+    }
+    vertices.swap(ordered);
+}
+
+} // namespace model
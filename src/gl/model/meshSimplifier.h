@@ -0,0 +1,479 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "model/bounds.h"
+#include "model/vertexFormat.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+/*
+Level of detail: quadric error edge collapse (Garland / Heckbert), index buffers only.
+
+    * simplify: collapses one vertex onto a neighbour (no new vertices), so every level draws from the vertex
+      buffer of the full mesh. Quadrics are kept per position, area weighted, and evaluated as the mean
+      squared distance to the planes a position has absorbed
+    * seams: vertices are grouped by position. A position with one wedge (vertex) and no open edge is free to
+      move. One wedge on an open edge is a border, two wedges split along the same edges are a uv / normal seam:
+      both only collapse along their own edge, a seam moves both wedges together. Anything else is locked.
+      Open edges add a plane perpendicular to the face so the outline keeps its shape
+    * passes: candidates sorted by error, each collapse locks the one ring of the position it removes, then
+      indices are rewritten and the adjacency rebuilt. A collapse that flips a triangle is skipped
+    * buildLods: every level is simplified from the full mesh to half the triangles of the previous one and
+      appended to the index buffer. Stops early once a level doesn't shrink or its error passes maxError
+    * selectLod: the coarsest level whose error, projected from the nearest point of the bounds, stays under
+      the pixel budget of the view (CullView::lodScale)
+*/
+
+namespace model
+{
+
+// one level inside the mesh's index buffer
+struct Lod
+{
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    float    error; // model space distance
+};
+static_assert(std::is_trivially_copyable<Lod>::value, "Lod is stored in the mesh cache as is");
+
+class MeshSimplifier
+{
+public:
+    static const unsigned int MAX_LODS = 5;
+
+    // indices of at most [targetIndexCount] unless that costs more than [maxError] (relative to the mesh
+    // extent). error: model space distance the result is off by
+    static std::vector<unsigned int> simplify(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices,
+                                              const size_t targetIndexCount, const float maxError, float* error = nullptr);
+
+    // appends up to [levels] - 1 simplified index buffers to [indices], level 0 is the input
+    static std::vector<Lod> buildLods(const std::vector<Vertex>& vertices, std::vector<unsigned int>& indices, const unsigned int levels,
+                                      const float maxError = 0.05f);
+
+    static unsigned int selectLod(const std::vector<Lod>& lods, const Sphere& bounds, const CullView& view);
+
+private:
+    enum eKind
+    {
+        eMANIFOLD = 0,
+        eBORDER,
+        eSEAM,
+        eLOCKED
+    };
+
+    // symmetric 4x4 of the plane equations, plus the weight they were added with
+    struct Quadric
+    {
+        float a00, a11, a22, a10, a20, a21;
+        float b0, b1, b2;
+        float c;
+        float w;
+
+        void addPlane(const glm::vec3& n, const float d, const float weight);
+        Quadric& operator+=(const Quadric& q);
+        // mean squared distance of [p] to the planes
+        float error(const glm::vec3& p) const;
+    };
+
+    struct Collapse
+    {
+        unsigned int v0, v1; // v0 moves onto v1
+        float error;
+    };
+
+    // openOut / openIn without a single open edge
+    enum : unsigned int
+    {
+        NONE = ~0u,
+        MANY = ~0u - 1
+    };
+};
+
+//////////////////// IMPLEMENTATION ////////////////////
+
+inline void MeshSimplifier::Quadric::addPlane(const glm::vec3& n, const float d, const float weight)
+{
+    a00 += weight * n.x * n.x;
+    a11 += weight * n.y * n.y;
+    a22 += weight * n.z * n.z;
+    a10 += weight * n.y * n.x;
+    a20 += weight * n.z * n.x;
+    a21 += weight * n.z * n.y;
+    b0  += weight * n.x * d;
+    b1  += weight * n.y * d;
+    b2  += weight * n.z * d;
+    c   += weight * d * d;
+    w   += weight;
+}
+
+inline MeshSimplifier::Quadric& MeshSimplifier::Quadric::operator+=(const Quadric& q)
+{
+    a00 += q.a00; a11 += q.a11; a22 += q.a22;
+    a10 += q.a10; a20 += q.a20; a21 += q.a21;
+    b0 += q.b0; b1 += q.b1; b2 += q.b2;
+    c += q.c;
+    w += q.w;
+    return *this;
+}
+
+inline float MeshSimplifier::Quadric::error(const glm::vec3& p) const
+{
+    const float rx = a00 * p.x + a10 * p.y + a20 * p.z + 2.0f * b0;
+    const float ry = a11 * p.y + a21 * p.z + 2.0f * b1;
+    const float rz = a22 * p.z + 2.0f * b2;
+    const float e = rx * p.x + ry * p.y + rz * p.z + c + a10 * p.x * p.y + a20 * p.x * p.z + a21 * p.y * p.z;
+    return w > 0.0f ? std::max(e, 0.0f) / w : 0.0f;
+}
+
+inline std::vector<unsigned int> MeshSimplifier::simplify(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& source,
+                                                          const size_t targetIndexCount, const float maxError, float* error)
+{
+    std::vector<unsigned int> indices(source);
+    if (error)
+        *error = 0.0f;
+    if (indices.size() <= targetIndexCount || vertices.empty())
+        return indices;
+
+    // positions scaled to the unit cube, errors are relative to the extent
+    glm::vec3 lo(vertices[0].Position), hi(lo);
+    for (const Vertex& vertex : vertices)
+    {
+        lo = glm::min(lo, vertex.Position);
+        hi = glm::max(hi, vertex.Position);
+    }
+    const float extent = std::max(std::max(hi.x - lo.x, hi.y - lo.y), hi.z - lo.z);
+    const float scale = extent > 0.0f ? 1.0f / extent : 1.0f;
+    const size_t vertexCount = vertices.size();
+    std::vector<glm::vec3> positions(vertexCount);
+    for (size_t i = 0; i < vertexCount; ++i)
+        positions[i] = (vertices[i].Position - lo) * scale;
+
+    // position id: first vertex at the same (bit identical) position, weld has merged the near ones
+    struct PositionHash
+    {
+        size_t operator()(const glm::vec3& p) const
+        {
+            // + 0: -0 and 0 compare equal, they have to hash the same
+            const glm::vec3 key = p + glm::vec3(0.0f);
+            uint32_t h[3];
+            std::memcpy(h, &key, sizeof(h));
+            return (h[0] * 73856093u) ^ (h[1] * 19349663u) ^ (h[2] * 83492791u);
+        }
+    };
+    std::vector<unsigned int> remap(vertexCount);
+    {
+        std::unordered_map<glm::vec3, unsigned int, PositionHash> first;
+        first.reserve(vertexCount);
+        for (unsigned int i = 0; i < vertexCount; ++i)
+            remap[i] = first.emplace(vertices[i].Position, i).first->second;
+    }
+
+    auto normal = [&positions](const unsigned int a, const unsigned int b, const unsigned int c)
+    {
+        return glm::cross(positions[b] - positions[a], positions[c] - positions[a]);
+    };
+
+    std::vector<Quadric> quadrics(vertexCount, Quadric());
+    std::vector<unsigned int> offsets(vertexCount + 1), adjacency, openOut(vertexCount), openIn(vertexCount), wedges, kinds(vertexCount);
+    std::vector<unsigned int> triangleOffsets(vertexCount + 1), triangles;
+    std::vector<Collapse> collapses;
+    std::vector<unsigned char> locked(vertexCount);
+    std::vector<unsigned int> collapse(vertexCount), owner;
+
+    // directed edges of the current triangles, per vertex
+    auto buildAdjacency = [&]()
+    {
+        std::fill(offsets.begin(), offsets.end(), 0u);
+        for (const unsigned int index : indices)
+            ++offsets[index + 1];
+        for (size_t i = 0; i < vertexCount; ++i)
+            offsets[i + 1] += offsets[i];
+        adjacency.resize(indices.size());
+        std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+        for (size_t t = 0; t < indices.size(); t += 3)
+        {
+            for (int k = 0; k < 3; ++k)
+                adjacency[fill[indices[t + k]]++] = indices[t + (k + 1) % 3];
+        }
+    };
+    auto hasEdge = [&](const unsigned int a, const unsigned int b)
+    {
+        for (unsigned int e = offsets[a]; e < offsets[a + 1]; ++e)
+            if (adjacency[e] == b)
+                return true;
+        return false;
+    };
+
+    // area weighted face planes, open edges add a perpendicular plane
+    const float BORDER_WEIGHT = 10.0f;
+    buildAdjacency();
+    for (size_t t = 0; t < indices.size(); t += 3)
+    {
+        const glm::vec3 n = normal(indices[t], indices[t + 1], indices[t + 2]);
+        const float area = glm::length(n);
+        if (area <= 0.0f)
+            continue;
+        const glm::vec3 unit = n / area;
+        for (int k = 0; k < 3; ++k)
+            quadrics[remap[indices[t + k]]].addPlane(unit, -glm::dot(unit, positions[indices[t]]), area * 0.5f);
+
+        for (int k = 0; k < 3; ++k)
+        {
+            const unsigned int a = indices[t + k], b = indices[t + (k + 1) % 3];
+            if (hasEdge(b, a))
+                continue;
+            const glm::vec3 edge = positions[b] - positions[a];
+            const float length = glm::length(edge);
+            if (length <= 0.0f)
+                continue;
+            const glm::vec3 side = glm::normalize(glm::cross(unit, edge));
+            const float d = -glm::dot(side, positions[a]);
+            quadrics[remap[a]].addPlane(side, d, length * length * BORDER_WEIGHT);
+            quadrics[remap[b]].addPlane(side, d, length * length * BORDER_WEIGHT);
+        }
+    }
+
+    float worst = 0.0f;
+    const float limit = maxError * maxError;
+    while (indices.size() > targetIndexCount)
+    {
+        buildAdjacency();
+
+        // open edges in vertex space: borders, and both sides of a seam
+        std::fill(openOut.begin(), openOut.end(), NONE);
+        std::fill(openIn.begin(), openIn.end(), NONE);
+        for (unsigned int a = 0; a < vertexCount; ++a)
+        {
+            for (unsigned int e = offsets[a]; e < offsets[a + 1]; ++e)
+            {
+                const unsigned int b = adjacency[e];
+                if (hasEdge(b, a))
+                    continue;
+                openOut[a] = openOut[a] == NONE ? b : MANY;
+                openIn[b] = openIn[b] == NONE ? a : MANY;
+            }
+        }
+
+        // wedges: the used vertices of a position, a circular list
+        wedges.assign(vertexCount, NONE);
+        owner.assign(vertexCount, NONE);
+        for (unsigned int i = 0; i < vertexCount; ++i)
+        {
+            if (offsets[i] == offsets[i + 1])
+                continue;
+            unsigned int& o = owner[remap[i]];
+            if (o == NONE)
+            {
+                o = i;
+                wedges[i] = i;
+            }
+            else
+            {
+                wedges[i] = wedges[o];
+                wedges[o] = i;
+            }
+        }
+
+        for (unsigned int i = 0; i < vertexCount; ++i)
+        {
+            if (offsets[i] == offsets[i + 1])
+                continue;
+            const unsigned int w = wedges[i];
+            const bool unique = openOut[i] < MANY && openIn[i] < MANY;
+            if (w == i)
+                kinds[i] = openOut[i] == NONE && openIn[i] == NONE ? eMANIFOLD : unique ? eBORDER : eLOCKED;
+            else if (wedges[w] == i && unique && openOut[w] < MANY && openIn[w] < MANY &&
+                     remap[openOut[i]] == remap[openIn[w]] && remap[openIn[i]] == remap[openOut[w]])
+                kinds[i] = eSEAM;
+            else
+                kinds[i] = eLOCKED;
+        }
+
+        // one ring of every position, by triangle
+        std::fill(triangleOffsets.begin(), triangleOffsets.end(), 0u);
+        for (const unsigned int index : indices)
+            ++triangleOffsets[remap[index] + 1];
+        for (size_t i = 0; i < vertexCount; ++i)
+            triangleOffsets[i + 1] += triangleOffsets[i];
+        triangles.resize(indices.size());
+        {
+            std::vector<unsigned int> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+            for (size_t t = 0; t < indices.size(); t += 3)
+                for (int k = 0; k < 3; ++k)
+                    triangles[fill[remap[indices[t + k]]]++] = (unsigned int)t;
+        }
+
+        // candidates, the cheaper direction of every edge that may collapse
+        auto allowed = [&](const unsigned int v0, const unsigned int v1)
+        {
+            if (remap[v0] == remap[v1])
+                return false;
+            switch (kinds[v0])
+            {
+            case eMANIFOLD:
+                return true;
+            case eBORDER:
+                return kinds[v1] == eBORDER && (openOut[v0] == v1 || openIn[v0] == v1);
+            case eSEAM:
+                return kinds[v1] == eSEAM && (openOut[v0] == v1 || openIn[v0] == v1);
+            default:
+                return false;
+            }
+        };
+        auto cost = [&](const unsigned int v0, const unsigned int v1)
+        {
+            Quadric q = quadrics[remap[v0]];
+            q += quadrics[remap[v1]];
+            return q.error(positions[v1]);
+        };
+        collapses.clear();
+        for (size_t t = 0; t < indices.size(); t += 3)
+        {
+            for (int k = 0; k < 3; ++k)
+            {
+                const unsigned int a = indices[t + k], b = indices[t + (k + 1) % 3];
+                const bool ab = allowed(a, b), ba = allowed(b, a);
+                if (!ab && !ba)
+                    continue;
+                const float eab = ab ? cost(a, b) : 0.0f, eba = ba ? cost(b, a) : 0.0f;
+                if (ab && (!ba || eab <= eba))
+                    collapses.push_back({ a, b, eab });
+                else
+                    collapses.push_back({ b, a, eba });
+            }
+        }
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) { return x.error < y.error; });
+
+        // a triangle around v0 that doesn't touch v1 may turn by 75 degrees at most once v0 sits on v1, slivers
+        // standing on the surface count as flipped
+        auto flips = [&](const unsigned int r0, const unsigned int r1, const glm::vec3& target)
+        {
+            for (unsigned int e = triangleOffsets[r0]; e < triangleOffsets[r0 + 1]; ++e)
+            {
+                const unsigned int* tri = &indices[triangles[e]];
+                glm::vec3 p[3];
+                bool touches = false;
+                for (int k = 0; k < 3; ++k)
+                {
+                    touches |= remap[tri[k]] == r1;
+                    p[k] = remap[tri[k]] == r0 ? target : positions[tri[k]];
+                }
+                if (touches)
+                    continue;
+                const glm::vec3 before = normal(tri[0], tri[1], tri[2]);
+                const glm::vec3 after = glm::cross(p[1] - p[0], p[2] - p[0]);
+                if (glm::dot(before, after) <= 0.25f * glm::length(before) * glm::length(after))
+                    return true;
+            }
+            return false;
+        };
+
+        // enough this pass: a collapse removes two triangles, one on a border
+        const size_t goal = (indices.size() - targetIndexCount) / 3;
+        size_t removed = 0, applied = 0;
+        std::fill(locked.begin(), locked.end(), 0);
+        for (unsigned int i = 0; i < vertexCount; ++i)
+            collapse[i] = i;
+        for (const Collapse& c : collapses)
+        {
+            if (c.error > limit || removed >= goal)
+                break;
+
+            const unsigned int r0 = remap[c.v0], r1 = remap[c.v1];
+            if (locked[r0] || locked[r1])
+                continue;
+
+            unsigned int s0 = NONE, s1 = NONE;
+            if (kinds[c.v0] == eSEAM)
+            {
+                // the other side follows along its own edge
+                s0 = wedges[c.v0];
+                s1 = wedges[c.v1];
+                if (openOut[s0] != s1 && openIn[s0] != s1)
+                    continue;
+            }
+            if (flips(r0, r1, positions[c.v1]))
+                continue;
+
+            collapse[c.v0] = c.v1;
+            if (s0 != NONE)
+                collapse[s0] = s1;
+            quadrics[r1] += quadrics[r0];
+            worst = std::max(worst, c.error);
+
+            for (unsigned int e = triangleOffsets[r0]; e < triangleOffsets[r0 + 1]; ++e)
+                for (int k = 0; k < 3; ++k)
+                    locked[remap[indices[triangles[e] + k]]] = 1;
+            removed += kinds[c.v0] == eBORDER ? 1 : 2;
+            ++applied;
+        }
+        if (applied == 0)
+            break;
+
+        // rewrite, dropping the triangles that lost an edge
+        size_t write = 0;
+        for (size_t t = 0; t < indices.size(); t += 3)
+        {
+            const unsigned int a = collapse[indices[t]], b = collapse[indices[t + 1]], c = collapse[indices[t + 2]];
+            if (remap[a] == remap[b] || remap[b] == remap[c] || remap[c] == remap[a])
+                continue;
+            indices[write++] = a;
+            indices[write++] = b;
+            indices[write++] = c;
+        }
+        indices.resize(write);
+    }
+
+    if (error)
+        *error = std::sqrt(worst) * extent;
+    return indices;
+}
+
+inline std::vector<Lod> MeshSimplifier::buildLods(const std::vector<Vertex>& vertices, std::vector<unsigned int>& indices, const unsigned int levels,
+                                                  const float maxError)
+{
+    std::vector<Lod> lods;
+    lods.push_back({ 0, (uint32_t)indices.size(), 0.0f });
+
+    const size_t full = indices.size();
+    size_t target = full;
+    for (unsigned int level = 1; level < levels && level < MAX_LODS; ++level)
+    {
+        target = (target / 2) / 3 * 3;
+        float error = 0.0f;
+        const std::vector<unsigned int> lod = simplify(vertices, std::vector<unsigned int>(indices.begin(), indices.begin() + full), target, maxError, &error);
+
+        // no real gain over the previous level
+        if (lod.empty() || lod.size() * 10 > (size_t)lods.back().indexCount * 9)
+            break;
+
+        lods.push_back({ (uint32_t)indices.size(), (uint32_t)lod.size(), std::max(error, lods.back().error) });
+        indices.insert(indices.end(), lod.begin(), lod.end());
+        target = lod.size();
+    }
+    return lods;
+}
+
+inline unsigned int MeshSimplifier::selectLod(const std::vector<Lod>& lods, const Sphere& bounds, const CullView& view)
+{
+    if (lods.size() < 2 || view.lodScale <= 0.0f)
+        return 0;
+
+    // pixels = error * lodScale / distance
+    const float distance = std::max(glm::length(bounds.center - view.eye) - bounds.radius, 1e-4f);
+    for (unsigned int level = (unsigned int)lods.size() - 1; level > 0; --level)
+    {
+        if (lods[level].error * view.lodScale <= distance)
+            return level;
+    }
+    return 0;
+}
+
+} // namespace model
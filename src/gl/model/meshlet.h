@@ -0,0 +1,171 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "model/bounds.h"
+#include "model/vertexFormat.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+/*
+Meshlets: small clusters of a mesh's triangles, culled one by one before drawing.
+
+    * build: greedy scan of the index buffer in its (vertex cache optimized) order, a meshlet is closed when
+      the next triangle would bring it past maxVertices unique vertices or maxTriangles triangles.
+      Meshlets are contiguous index ranges, the index buffer is not touched and visible neighbours are drawn
+      as one ranged draw
+    * bounding sphere: center of the AABB, radius to the farthest vertex
+    * normal cone: axis = normalized sum of the triangle normals, cutoff = sine of the largest angle between
+      a normal and the axis. A cluster whose triangles all face away from the eye is skipped. Cutoff 1 (a spread
+      of 90 degrees or more) is never back facing. Counter-clockwise triangles are front facing, as for GL_CULL_FACE
+
+    Built at import with ImportSettings::meshlets and stored in the mesh cache.
+*/
+
+namespace model
+{
+
+struct Meshlet
+{
+    uint32_t  firstIndex; // into the mesh's index buffer
+    uint32_t  indexCount; // triangles * 3
+    glm::vec3 center;
+    float     radius;
+    glm::vec3 coneAxis;
+    float     coneCutoff;
+};
+static_assert(std::is_trivially_copyable<Meshlet>::value, "Meshlet is stored in the mesh cache as is");
+
+class MeshletBuilder
+{
+public:
+    static const unsigned int MAX_VERTICES  = 64;
+    static const unsigned int MAX_TRIANGLES = 124;
+
+    static std::vector<Meshlet> build(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices,
+                                      const unsigned int maxVertices = MAX_VERTICES, const unsigned int maxTriangles = MAX_TRIANGLES);
+
+    // false when the cluster is off screen or back facing seen from [view]
+    static bool visible(const Meshlet& meshlet, const CullView& view);
+
+private:
+    static void bound(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices, Meshlet& meshlet);
+};
+
+//////////////////// IMPLEMENTATION ////////////////////
+
+inline std::vector<Meshlet> MeshletBuilder::build(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices,
+                                                  const unsigned int maxVertices, const unsigned int maxTriangles)
+{
+    std::vector<Meshlet> meshlets;
+    const size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0)
+        return meshlets;
+
+    // stamp: id of the last meshlet that used the vertex
+    std::vector<uint32_t> stamp(vertices.size(), ~0u);
+    Meshlet current = {};
+    unsigned int vertexCount = 0;
+    uint32_t id = 0;
+
+    for (size_t t = 0; t < triangleCount; ++t)
+    {
+        const unsigned int* triangle = &indices[t * 3];
+        unsigned int added = 0; // duplicates within the triangle count once
+        for (int k = 0; k < 3; ++k)
+            added += stamp[triangle[k]] != id && (k < 1 || triangle[k] != triangle[0]) && (k < 2 || triangle[k] != triangle[1]);
+
+        if (vertexCount + added > maxVertices || current.indexCount / 3 + 1 > maxTriangles)
+        {
+            bound(vertices, indices, current);
+            meshlets.push_back(current);
+
+            current = {};
+            current.firstIndex = (uint32_t)(t * 3);
+            vertexCount = 0;
+            ++id;
+        }
+
+        for (int k = 0; k < 3; ++k)
+        {
+            if (stamp[triangle[k]] != id)
+            {
+                stamp[triangle[k]] = id;
+                ++vertexCount;
+            }
+        }
+        current.indexCount += 3;
+    }
+
+    bound(vertices, indices, current);
+    meshlets.push_back(current);
+    return meshlets;
+}
+
+inline void MeshletBuilder::bound(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices, Meshlet& meshlet)
+{
+    const unsigned int* begin = &indices[meshlet.firstIndex];
+    const unsigned int* end = begin + meshlet.indexCount;
+
+    glm::vec3 lo(vertices[*begin].Position), hi(lo);
+    for (const unsigned int* i = begin; i != end; ++i)
+    {
+        lo = glm::min(lo, vertices[*i].Position);
+        hi = glm::max(hi, vertices[*i].Position);
+    }
+    meshlet.center = (lo + hi) * 0.5f;
+
+    float radius2 = 0.0f;
+    for (const unsigned int* i = begin; i != end; ++i)
+    {
+        const glm::vec3 d = vertices[*i].Position - meshlet.center;
+        radius2 = std::max(radius2, glm::dot(d, d));
+    }
+    meshlet.radius = std::sqrt(radius2);
+
+    // unit face normals, degenerate triangles don't vote
+    std::vector<glm::vec3> normals;
+    normals.reserve(meshlet.indexCount / 3);
+    glm::vec3 axis(0.0f);
+    for (const unsigned int* i = begin; i != end; i += 3)
+    {
+        const glm::vec3 n = glm::cross(vertices[i[1]].Position - vertices[i[0]].Position, vertices[i[2]].Position - vertices[i[0]].Position);
+        const float length = glm::length(n);
+        if (length > 0.0f)
+        {
+            normals.push_back(n / length);
+            axis += normals.back();
+        }
+    }
+
+    meshlet.coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+    meshlet.coneCutoff = 1.0f;
+    const float axisLength = glm::length(axis);
+    if (normals.empty() || axisLength <= 0.0f)
+        return;
+
+    axis /= axisLength;
+    float minDot = 1.0f;
+    for (const glm::vec3& n : normals)
+        minDot = std::min(minDot, glm::dot(n, axis));
+
+    meshlet.coneAxis = axis;
+    if (minDot > 0.0f)
+        meshlet.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+}
+
+inline bool MeshletBuilder::visible(const Meshlet& meshlet, const CullView& view)
+{
+    if (!view.frustum.intersects({ meshlet.center, meshlet.radius }))
+        return false;
+
+    // every triangle faces away from any point of the bounding sphere
+    const glm::vec3 toCenter = meshlet.center - view.eye;
+    return glm::dot(toCenter, meshlet.coneAxis) < meshlet.coneCutoff * glm::length(toCenter) + meshlet.radius;
+}
+
+} // namespace model
@@ -0,0 +1,227 @@
+#pragma once
+
+#include "model/dds.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define OGL_MIPMAP_SSE2
+#endif
+
+/*
+Mip chains built on the cpu, replaces glGenerateMipmap:
+
+    * 2x2 box filter, odd sizes drop the last row / column like the driver does
+    * srgb: color channels are averaged in linear space (256 entry decode table, 4096 entry encode table),
+      alpha is always linear
+    * SSE2 for the vertical sums and for 4 component rows, scalar elsewhere and on other architectures
+
+    Runs on the decode threads, the levels are stored next to the decoded pixels and uploaded with one
+    glTexImage2D each. TextureLoader keeps the result in <name>.mipcache next to the source, later loads read
+    it instead of decoding the png and building the chain again.
+*/
+
+namespace model
+{
+
+class Mipmap
+{
+public:
+    // one level down, [dst] holds max(1, width / 2) * max(1, height / 2) * components bytes
+    static void downsample(const unsigned char* src, const int width, const int height, const int components, const bool srgb, unsigned char* dst);
+
+    // sizes of levels 1..n down to 1x1, appended to [levels] from [offset] on. Returns the offset past the last
+    static size_t layout(const int width, const int height, const int components, size_t offset, std::vector<dds::Level>& levels);
+    // levels 1..n down to 1x1, appended to [data]. Level offsets are into [data]
+    static void build(const unsigned char* pixels, const int width, const int height, const int components, const bool srgb,
+                      std::vector<dds::Level>& levels, std::vector<unsigned char>& data);
+
+private:
+    struct Tables
+    {
+        float toLinear[256];
+        unsigned char toSrgb[4096];
+        Tables();
+    };
+    static const Tables& tables();
+
+    // [sums] is scratch for the vertical pass, reused across rows
+    static void downsampleLinear(const unsigned char* row0, const unsigned char* row1, const int width, const int components,
+                                 std::vector<uint16_t>& sums, unsigned char* dst);
+    static void downsampleSrgb(const unsigned char* row0, const unsigned char* row1, const int width, const int components,
+                               std::vector<float>& sums, unsigned char* dst);
+};
+
+//////////////////// IMPLEMENTATION ////////////////////
+
+inline Mipmap::Tables::Tables()
+{
+    for (int i = 0; i < 256; ++i)
+    {
+        const float c = i / 255.0f;
+        toLinear[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+    }
+    for (int i = 0; i < 4096; ++i)
+    {
+        const float l = i / 4095.0f;
+        const float c = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+        toSrgb[i] = (unsigned char)std::lround(std::min(1.0f, std::max(0.0f, c)) * 255.0f);
+    }
+}
+
+inline const Mipmap::Tables& Mipmap::tables()
+{
+    static const Tables t;
+    return t;
+}
+
+inline void Mipmap::downsample(const unsigned char* src, const int width, const int height, const int components, const bool srgb, unsigned char* dst)
+{
+    const int halfWidth  = std::max(1, width / 2);
+    const int halfHeight = std::max(1, height / 2);
+    const size_t stride = (size_t)width * components;
+    std::vector<uint16_t> sums;
+    std::vector<float> linearSums;
+
+    for (int y = 0; y < halfHeight; ++y)
+    {
+        const unsigned char* row0 = src + std::min(2 * y, height - 1) * stride;
+        const unsigned char* row1 = src + std::min(2 * y + 1, height - 1) * stride;
+        unsigned char* out = dst + (size_t)y * halfWidth * components;
+
+        if (srgb && components >= 3)
+            downsampleSrgb(row0, row1, width, components, linearSums, out);
+        else
+            downsampleLinear(row0, row1, width, components, sums, out);
+    }
+}
+
+inline void Mipmap::downsampleLinear(const unsigned char* row0, const unsigned char* row1, const int width, const int components,
+                                     std::vector<uint16_t>& sums, unsigned char* dst)
+{
+    const int halfWidth = std::max(1, width / 2);
+    const int count = width == 1 ? components : halfWidth * 2 * components; // source bytes that are used
+
+    // vertical sums, 16 bit
+    sums.resize(count);
+    int i = 0;
+#ifdef OGL_MIPMAP_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= count; i += 16)
+    {
+        const __m128i a = _mm_loadu_si128((const __m128i*)(row0 + i));
+        const __m128i b = _mm_loadu_si128((const __m128i*)(row1 + i));
+        _mm_storeu_si128((__m128i*)&sums[i],     _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)));
+        _mm_storeu_si128((__m128i*)&sums[i + 8], _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero)));
+    }
+#endif
+    for (; i < count; ++i)
+        sums[i] = (uint16_t)(row0[i] + row1[i]);
+
+    if (width == 1)
+    {
+        for (int c = 0; c < components; ++c)
+            dst[c] = (unsigned char)((sums[c] + 1) / 2);
+        return;
+    }
+
+    // horizontal pairs
+    int x = 0;
+#ifdef OGL_MIPMAP_SSE2
+    if (components == 4)
+    {
+        const __m128i two = _mm_set1_epi16(2);
+        for (; x + 2 <= halfWidth; x += 2)
+        {
+            // source pixels 0..3 of this pair of outputs, 4 lanes each
+            const __m128i p01 = _mm_loadu_si128((const __m128i*)&sums[x * 8]);
+            const __m128i p23 = _mm_loadu_si128((const __m128i*)&sums[x * 8 + 8]);
+            const __m128i even = _mm_unpacklo_epi64(p01, p23);
+            const __m128i odd  = _mm_unpackhi_epi64(p01, p23);
+            const __m128i avg  = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(even, odd), two), 2);
+            _mm_storel_epi64((__m128i*)(dst + x * 4), _mm_packus_epi16(avg, avg));
+        }
+    }
+#endif
+    for (; x < halfWidth; ++x)
+    {
+        for (int c = 0; c < components; ++c)
+            dst[x * components + c] = (unsigned char)((sums[2 * x * components + c] + sums[(2 * x + 1) * components + c] + 2) / 4);
+    }
+}
+
+inline void Mipmap::downsampleSrgb(const unsigned char* row0, const unsigned char* row1, const int width, const int components,
+                                   std::vector<float>& sums, unsigned char* dst)
+{
+    const Tables& t = tables();
+    const int halfWidth = std::max(1, width / 2);
+    const int count = width == 1 ? components : halfWidth * 2 * components;
+    const int alpha = components == 4 ? 3 : -1;
+
+    // decode and vertical sums in float
+    sums.resize(count);
+    for (int i = 0; i < count; ++i)
+    {
+        const bool linear = i % components == alpha;
+        sums[i] = linear ? (row0[i] + row1[i]) / 255.0f : t.toLinear[row0[i]] + t.toLinear[row1[i]];
+    }
+
+    float avg[4];
+    for (int x = 0; x < halfWidth; ++x)
+    {
+        const float* a = &sums[(width == 1 ? 0 : 2 * x) * components];
+        const float* b = width == 1 ? a : a + components;
+#ifdef OGL_MIPMAP_SSE2
+        if (components == 4)
+            _mm_storeu_ps(avg, _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(a), _mm_loadu_ps(b)), _mm_set1_ps(0.25f)));
+        else
+#endif
+        for (int c = 0; c < components; ++c)
+            avg[c] = (a[c] + b[c]) * 0.25f;
+
+        for (int c = 0; c < components; ++c)
+        {
+            const float v = std::min(1.0f, std::max(0.0f, avg[c]));
+            dst[x * components + c] = c == alpha ? (unsigned char)(v * 255.0f + 0.5f) : t.toSrgb[(int)(v * 4095.0f + 0.5f)];
+        }
+    }
+}
+
+inline size_t Mipmap::layout(const int width, const int height, const int components, size_t offset, std::vector<dds::Level>& levels)
+{
+    int w = width, h = height;
+    while (w > 1 || h > 1)
+    {
+        w = std::max(1, w / 2);
+        h = std::max(1, h / 2);
+        const size_t size = (size_t)w * h * components;
+        levels.push_back({ w, h, offset, size });
+        offset += size;
+    }
+    return offset;
+}
+
+inline void Mipmap::build(const unsigned char* pixels, const int width, const int height, const int components, const bool srgb,
+                          std::vector<dds::Level>& levels, std::vector<unsigned char>& data)
+{
+    // sizes first, so the data never moves while it is being filled
+    const size_t first = levels.size();
+    data.resize(layout(width, height, components, data.size(), levels));
+
+    const unsigned char* src = pixels;
+    int w = width, h = height;
+    for (size_t i = first; i < levels.size(); ++i)
+    {
+        unsigned char* dst = data.data() + levels[i].offset;
+        downsample(src, w, h, components, srgb, dst);
+        src = dst;
+        w = levels[i].width;
+        h = levels[i].height;
+    }
+}
+
+} // namespace model
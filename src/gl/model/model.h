@@ -7,118 +7,507 @@
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
-
-#include <stbimage/stb_image.h>
-#define STB_IMAGE_IMPLEMENTATION
-#include <stbimage/stb_image.h>
+#include <glm/gtc/type_ptr.hpp>
 
 #include <assimp/Importer.hpp>
+#include <assimp/ProgressHandler.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
 #include "model/mesh.h"
+#include "model/meshCache.h"
+#include "model/meshOptimizer.h"
+#include "model/sceneDraw.h"
+#include "model/texture.h"
+#include "model/textureCache.h"
 #include "shaderManager/ShaderManager.h"
+#include "util/threadPool.h"
 
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <algorithm>
+#include <functional>
 #include <map>
+#include <unordered_map>
 #include <vector>
 
 namespace model
 {
 
-class TextureLoader
+// result of the cpu phase: every aiMesh once, nodes refer to them by index
+struct SceneData
 {
-public:
-    static unsigned int loadTexture(const char* path, const std::string& directory, bool gamma = false);
+    std::vector<MeshData>    meshes;
+    std::vector<cache::Node> nodes; // pre-order, parent before children
+};
+
+// cpu phase options, part of the mesh cache key
+struct ImportSettings
+{
+    float weldEpsilon = 1e-5f; // < 0 disables welding, 0 welds bit identical vertices only
+    bool  optimize = true;     // vertex cache + vertex fetch order
+    bool  meshlets = false;    // MeshletBuilder clusters, culled per cluster against the cull view
+    unsigned int lods = 1;     // levels of detail per mesh, level 0 included (up to MeshSimplifier::MAX_LODS)
+    float lodMaxError = 0.05f; // coarsest error a level may have, relative to the mesh extent
 };
 
 class Model
 {
 public:
     Model(const std::string& path, bool gamma = false);
+    // textures are shared through TextureCache and released here
+    Model(const Model&) = delete;
+    Model& operator=(const Model&) = delete;
+    ~Model();
+
     void Draw(ShaderManager& shader);
+    void DrawDepth(ShaderManager& shader);
+    // [count] copies of the model in one instanced draw per mesh, copy k placed by transforms[k] in place of
+    // setTransform(). Copies are culled whole against the view, levels of detail follow the nearest one
+    void DrawInstanced(ShaderManager& shader, const glm::mat4* transforms, const size_t count);
+    void DrawInstanced(ShaderManager& shader, const std::vector<glm::mat4>& transforms) { DrawInstanced(shader, transforms.data(), transforms.size()); }
+    void DrawDepthInstanced(ShaderManager& shader, const glm::mat4* transforms, const size_t count);
+    void DrawDepthInstanced(ShaderManager& shader, const std::vector<glm::mat4>& transforms) { DrawDepthInstanced(shader, transforms.data(), transforms.size()); }
+
+    // camera of the next draws, see WorldView. Meshes outside it are culled, and with
+    // MeshCuller::settings().occlusion those behind the biggest ones too. Draw() holds back meshes
+    // hidden in earlier frames with MeshCuller::settings().occlusionQueries
+    void setView(const WorldView& view) { m_draw.setView(view); }
+    void clearView() { m_draw.clearView(); }
+    // of the last Draw
+    const DrawStats& drawStats() const { return m_draw.drawStats(); }
+
+    // where the model is placed, above its root node. Nodes keep their imported local transforms,
+    // graph().setLocal() moves them. A mesh referenced by one visible node draws with that node's world matrix
+    // as "model", one referenced by several draws them all as instances
+    void setTransform(const glm::mat4& transform) { m_draw.setTransform(transform); }
+    SceneGraph& graph() { return m_draw.graph(); }
+
+    // nearest mesh under a world space ray, e.g. Ray::fromScreen()
+    bool pick(const Ray& ray, PickHit& hit);
+
+    // decode / upload cost of every texture this model loaded
+    const std::vector<TextureTiming>& textureTimings() const { return m_texTimings; }
+
+    // set before loading, shared by every model
+    static ImportSettings& settings();
+    // mesh cache key: source file, import flags, settings and the attributes the program reads
+    static bool cacheKey(const std::string& path, uint64_t& key);
+
+    static const unsigned int IMPORT_FLAGS = //aiProcess_GenNormals | // generate normal for vertex
+                                             aiProcess_Triangulate | // transfrom all to triangles
+                                             aiProcess_FlipUVs;
+    // IMPORT_FLAGS plus normal generation when Mesh::uploadSettings().attributes needs normals.
+    // Tangents are MeshOptimizer::computeTangents()' job, only meshes with a normal map get them
+    static unsigned int importFlags();
 
 private:
+    friend class AsyncModel;
+    friend class TextureCompressor;
+
     void loadModel(const std::string& path);
-    void processNode(aiNode* node, const aiScene* scene);
-    Mesh processMesh(aiMesh* mesh, const aiScene* scene);
-    std::vector<Texture> loadMaterialTextures(aiMaterial* mat, const aiTextureType type, const std::string typeName);
+    // warm start, false if the cache is missing, stale or corrupt
+    bool loadCache(const std::string& cachePath, const uint64_t key);
+
+    // cpu phase: any thread, touches no model state and no GL.
+    // progress receives [0, 1] during the Assimp import and returns false to abort it
+    static bool importScene(const std::string& path, SceneData& scene, const std::function<bool(float)>& progress = nullptr);
+    static void processNode(aiNode* node, const int parent, std::vector<cache::Node>& nodes);
+    static MeshData processMesh(aiMesh* mesh, const aiScene* scene);
+    // names of every texture [material] uses, by shader sampler type
+    static std::vector<Texture> materialTextures(aiMaterial* material);
+    static std::vector<Texture> loadMaterialTextures(aiMaterial* mat, const aiTextureType type, const std::string typeName);
+
+    // gl phase
+    void preloadTextures(const std::vector<Texture>& textures);
+    // UploadSettings::sharedBuffer: every source once in m_buffer, one Mesh per source drawing its range
+    void setupShared(const std::vector<MeshSource>& sources, const std::vector<std::vector<Texture>>& textures);
+    // without a shared buffer, takes the geometry of [mesh]
+    static void emplaceMesh(std::vector<Mesh>& meshes, MeshData& mesh, std::vector<Texture>&& textures);
+    Texture loadMaterialTexture(const std::string& name, const std::string& typeName);
 
 private:
     // model data 
-    std::vector<Mesh>    m_meshes;
-    std::vector<Texture> m_texLoaded;
+    std::vector<Mesh>    m_meshes; // one per scene mesh
+    MeshBuffer           m_buffer; // UploadSettings::sharedBuffer only
+    SceneDraw            m_draw;   // graph, instances and culling
+    std::unordered_map<std::string, Texture> m_texLoaded; // by name, one TextureCache reference each
+    std::vector<TextureTiming> m_texTimings;
 
     std::string m_directory;
     bool m_gammaCorrection;
 };
 
+// forwards Assimp's progress callbacks
+class ImportProgress : public Assimp::ProgressHandler
+{
+public:
+    explicit ImportProgress(const std::function<bool(float)>& callback) : m_callback(callback) {}
+    bool Update(float percentage) override { return m_callback(percentage < 0.0f ? 0.0f : percentage); }
+
+private:
+    std::function<bool(float)> m_callback;
+};
+
 //////////////////// IMPLEMENTATION ////////////////////
 
 Model::Model(const std::string& path, bool gamma) 
     : m_gammaCorrection(gamma)
 {
     stbi_set_flip_vertically_on_load(true);
+    TextureLoader::detectFormats();
     loadModel(path);
 }
 
+ImportSettings& Model::settings()
+{
+    static ImportSettings settings;
+    return settings;
+}
+
+unsigned int Model::importFlags()
+{
+    const unsigned int normals = (1u << eNORMAL) | (1u << eTANGENT) | (1u << eBITANGENT);
+    return IMPORT_FLAGS | (Mesh::uploadSettings().attributes & normals ? (unsigned int)aiProcess_GenSmoothNormals : 0u);
+}
+
+bool Model::cacheKey(const std::string& path, uint64_t& key)
+{
+    if (!cache::sourceKey(path, importFlags(), key))
+        return false;
+
+    const ImportSettings& s = settings();
+    key = util::hash(&s.weldEpsilon, sizeof(s.weldEpsilon), key);
+    key = util::hash(&s.optimize, sizeof(s.optimize), key);
+    key = util::hash(&s.meshlets, sizeof(s.meshlets), key);
+    key = util::hash(&s.lods, sizeof(s.lods), key);
+    key = util::hash(&s.lodMaxError, sizeof(s.lodMaxError), key);
+    key = util::hash(&Mesh::uploadSettings().attributes, sizeof(unsigned int), key);
+    return true;
+}
+
+Model::~Model()
+{
+    for (const auto& loaded : m_texLoaded)
+        TextureCache::instance().release(loaded.second.id);
+}
+
 void Model::Draw(ShaderManager &shader)
 {
-    for (unsigned int i = 0; i < m_meshes.size(); i++)
-        m_meshes[i].Draw(shader);
+    m_draw.Draw(shader, m_meshes, m_buffer);
+}
+
+void Model::DrawDepth(ShaderManager& shader)
+{
+    m_draw.DrawDepth(shader, m_meshes, m_buffer);
+}
+
+void Model::DrawInstanced(ShaderManager& shader, const glm::mat4* transforms, const size_t count)
+{
+    m_draw.DrawInstanced(shader, m_meshes, m_buffer, transforms, count);
+}
+
+void Model::DrawDepthInstanced(ShaderManager& shader, const glm::mat4* transforms, const size_t count)
+{
+    m_draw.DrawDepthInstanced(shader, m_meshes, m_buffer, transforms, count);
+}
+
+bool Model::pick(const Ray& ray, PickHit& hit)
+{
+    return m_draw.pick(m_meshes, ray, hit);
+}
+
+void Model::setupShared(const std::vector<MeshSource>& sources, const std::vector<std::vector<Texture>>& textures)
+{
+    const UploadSettings& upload = Mesh::uploadSettings();
+    std::vector<DrawRange> ranges;
+    m_buffer.create(sources, upload.attributes, upload.packVertices, upload.positionStream, ranges);
+
+    m_meshes.reserve(sources.size());
+    for (size_t i = 0; i < sources.size(); ++i)
+        m_meshes.emplace_back(m_buffer, ranges[i], std::vector<Texture>(textures[i]));
+}
+
+void Model::emplaceMesh(std::vector<Mesh>& meshes, MeshData& mesh, std::vector<Texture>&& textures)
+{
+    meshes.emplace_back(std::move(mesh.vertices), std::move(mesh.indices), std::move(textures), mesh.attributes);
+    meshes.back().m_detail = std::move(mesh.detail);
 }
 
 void Model::loadModel(const std::string& path)
+{
+    m_directory = path.substr(0, path.find_last_of('/'));
+
+    // binary cache next to the source
+    const std::string cachePath = path + ".meshcache";
+    uint64_t key = 0;
+    const bool cacheable = cacheKey(path, key);
+    if (cacheable && loadCache(cachePath, key))
+        return;
+
+    SceneData scene;
+    if (!importScene(path, scene))
+        return;
+
+    if (cacheable)
+        cache::write(cachePath, key, scene.meshes, scene.nodes);
+
+    // gl phase on the context thread
+    std::vector<Texture> textures;
+    for (const MeshData& mesh : scene.meshes)
+        textures.insert(textures.end(), mesh.textures.begin(), mesh.textures.end());
+    preloadTextures(textures);
+
+    for (MeshData& mesh : scene.meshes)
+    {
+        for (Texture& texture : mesh.textures)
+            texture = loadMaterialTexture(texture.name, texture.type);
+    }
+
+    // one instance per node reference, in the order processNode visited them, placed by its node
+    for (const cache::Node& node : scene.nodes)
+    {
+        const unsigned int added = m_draw.graph().add(node.parent, node.transform);
+        for (const unsigned int mesh : node.meshes)
+            m_draw.add(mesh, added);
+    }
+
+    if (Mesh::uploadSettings().sharedBuffer)
+    {
+        std::vector<MeshSource> sources;
+        std::vector<std::vector<Texture>> textures;
+        for (const MeshData& mesh : scene.meshes)
+        {
+            sources.push_back(mesh.source());
+            textures.push_back(mesh.textures);
+        }
+        setupShared(sources, textures);
+        for (size_t i = 0; i < scene.meshes.size(); ++i)
+        {
+            m_meshes[i].m_detail = scene.meshes[i].detail;
+            m_meshes[i].keepBaseLevel(sources[i]);
+        }
+        return;
+    }
+
+    m_meshes.reserve(scene.meshes.size());
+    for (MeshData& mesh : scene.meshes)
+        emplaceMesh(m_meshes, mesh, std::vector<Texture>(mesh.textures));
+}
+
+bool Model::loadCache(const std::string& cachePath, const uint64_t key)
+{
+    cache::CacheFile file;
+    if (!file.open(cachePath, key))
+        return false;
+
+    std::vector<std::vector<Texture>> textures(file.meshCount());
+    for (unsigned int i = 0; i < file.meshCount(); ++i)
+    {
+        const cache::MeshRecord& record = file.mesh(i);
+        for (unsigned int t = record.firstTexture; t < record.firstTexture + record.textureCount; ++t)
+            textures[i].push_back({ 0, file.textureType(t), file.textureName(t) });
+    }
+
+    std::vector<Texture> all;
+    for (const std::vector<Texture>& meshTextures : textures)
+        all.insert(all.end(), meshTextures.begin(), meshTextures.end());
+    preloadTextures(all);
+
+    for (std::vector<Texture>& meshTextures : textures)
+    {
+        for (Texture& texture : meshTextures)
+            texture = loadMaterialTexture(texture.name, texture.type);
+    }
+
+    std::vector<MeshSource> sources;
+    for (unsigned int i = 0; i < file.meshCount(); ++i)
+    {
+        const cache::MeshRecord& record = file.mesh(i);
+        sources.push_back({ file.vertices(i), record.vertexCount, file.indices(i), record.indexCount, file.indexType(i), record.attributes });
+    }
+
+    // nodes are stored in the same order processNode visits them
+    for (unsigned int n = 0; n < file.nodeCount(); ++n)
+    {
+        const cache::NodeRecord& node = file.node(n);
+        const unsigned int added = m_draw.graph().add(node.parent, glm::make_mat4(node.transform));
+        for (unsigned int m = 0; m < node.meshCount; ++m)
+            m_draw.add(file.nodeMeshes(n)[m], added);
+    }
+
+    if (Mesh::uploadSettings().sharedBuffer)
+        setupShared(sources, textures);
+    else
+    {
+        m_meshes.reserve(sources.size());
+        for (unsigned int i = 0; i < file.meshCount(); ++i)
+            m_meshes.emplace_back(sources[i], std::vector<Texture>(textures[i]));
+    }
+    // picking and occluders read level 0 on the cpu, the mapping goes away with [file]
+    for (unsigned int i = 0; i < file.meshCount(); ++i)
+    {
+        m_meshes[i].m_detail = file.detail(i);
+        m_meshes[i].keepBaseLevel(sources[i]);
+    }
+    return true;
+}
+
+bool Model::importScene(const std::string& path, SceneData& data, const std::function<bool(float)>& progress)
 {
     // read file via ASSIMP
     Assimp::Importer importer;
-    const aiScene *scene = importer.ReadFile(path,
-                                             //aiProcess_GenNormals | // generate normal for vertex
-                                             aiProcess_Triangulate | // transfrom all to triangles
-                                             aiProcess_GenSmoothNormals |
-                                             aiProcess_FlipUVs |
-                                             aiProcess_CalcTangentSpace);
+    if (progress)
+        importer.SetProgressHandler(new ImportProgress(progress)); // the importer owns the handler
+    const aiScene *scene = importer.ReadFile(path, importFlags());
 
     if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
     {
         std::cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << std::endl;
-        return;
+        return false;
+    }
+
+    // each job writes its own slot so the mesh order doesn't depend on scheduling
+    const ImportSettings s = settings();
+    const unsigned int tangentSpace = (1u << eTANGENT) | (1u << eBITANGENT);
+    const bool tangents = (Mesh::uploadSettings().attributes & tangentSpace) != 0;
+    data.meshes.resize(scene->mNumMeshes);
+    std::vector<MeshOptimizer::CacheStats> cacheBefore(scene->mNumMeshes), cacheAfter(scene->mNumMeshes);
+    util::defaultPool().parallelFor(scene->mNumMeshes, [&](const size_t i)
+    {
+        MeshData& mesh = data.meshes[i];
+        mesh = processMesh(scene->mMeshes[i], scene);
+        if (s.weldEpsilon >= 0.0f)
+            MeshOptimizer::weld(mesh.vertices, mesh.indices, s.weldEpsilon);
+
+        // tangent space only feeds normal mapping
+        const bool normalMap = std::any_of(mesh.textures.begin(), mesh.textures.end(),
+                                           [](const Texture& texture) { return texture.type == "texture_normal"; });
+        const unsigned int surface = (1u << eNORMAL) | (1u << eTEXCOORDS);
+        if (tangents && normalMap && (mesh.attributes & surface) == surface)
+        {
+            MeshOptimizer::computeTangents(mesh.vertices, mesh.indices);
+            mesh.attributes |= tangentSpace;
+        }
+
+        // levels share the vertices, each is appended to the index buffer
+        if (s.lods > 1)
+            mesh.detail.lods = MeshSimplifier::buildLods(mesh.vertices, mesh.indices, s.lods, s.lodMaxError);
+
+        if (s.optimize)
+        {
+            // every level in its own triangle order, then the vertices in the order level 0 uses them
+            const std::vector<Lod> levels = mesh.detail.lods.empty() ? std::vector<Lod>{ { 0, (uint32_t)mesh.indices.size(), 0.0f } } : mesh.detail.lods;
+            for (size_t l = 0; l < levels.size(); ++l)
+            {
+                std::vector<unsigned int> level(mesh.indices.begin() + levels[l].firstIndex, mesh.indices.begin() + levels[l].firstIndex + levels[l].indexCount);
+                if (l == 0)
+                    cacheBefore[i] = MeshOptimizer::analyzeVertexCache(level, mesh.vertices.size());
+                MeshOptimizer::optimizeVertexCache(level, mesh.vertices.size());
+                if (l == 0)
+                    cacheAfter[i] = MeshOptimizer::analyzeVertexCache(level, mesh.vertices.size());
+                std::copy(level.begin(), level.end(), mesh.indices.begin() + levels[l].firstIndex);
+            }
+            MeshOptimizer::optimizeVertexFetch(mesh.vertices, mesh.indices);
+        }
+
+        // Assimp's aiProcess_GenBoundingBoxes would only cover the imported vertices, welding may drop some
+        mesh.detail.box = Aabb::around(mesh.vertices.data(), mesh.vertices.size());
+        mesh.detail.bounds = Sphere::around(mesh.vertices.data(), mesh.vertices.size());
+
+        // after the reorder, clusters follow the cache friendly triangle order
+        if (s.meshlets)
+        {
+            const size_t base = mesh.detail.baseIndexCount(mesh.indices.size());
+            mesh.detail.meshlets = MeshletBuilder::build(mesh.vertices, std::vector<unsigned int>(mesh.indices.begin(), mesh.indices.begin() + base));
+        }
+    });
+
+    if (s.weldEpsilon >= 0.0f)
+    {
+        size_t before = 0, after = 0;
+        for (unsigned int i = 0; i < scene->mNumMeshes; ++i)
+        {
+            before += scene->mMeshes[i]->mNumVertices;
+            after  += data.meshes[i].vertices.size();
+        }
+        std::cout << "Model:: welded " << before << " -> " << after << " vertices (epsilon " << s.weldEpsilon << ")" << std::endl;
+    }
+    if (s.optimize)
+    {
+        MeshOptimizer::CacheStats before, after;
+        for (unsigned int i = 0; i < scene->mNumMeshes; ++i)
+        {
+            before += cacheBefore[i];
+            after  += cacheAfter[i];
+        }
+        std::cout << "Model:: vertex cache (FIFO 16) ACMR " << before.acmr() << " -> " << after.acmr()
+                  << ", ATVR " << before.atvr() << " -> " << after.atvr() << std::endl;
+    }
+    if (s.meshlets)
+    {
+        size_t meshlets = 0;
+        for (const MeshData& mesh : data.meshes)
+            meshlets += mesh.detail.meshlets.size();
+        std::cout << "Model:: " << meshlets << " meshlets (" << MeshletBuilder::MAX_VERTICES << " vertices / "
+                  << MeshletBuilder::MAX_TRIANGLES << " triangles)" << std::endl;
+    }
+    if (s.lods > 1)
+    {
+        // triangles summed over the meshes that have the level
+        std::vector<size_t> triangles;
+        for (const MeshData& mesh : data.meshes)
+        {
+            triangles.resize(std::max(triangles.size(), mesh.detail.lods.size()), 0);
+            for (size_t l = 0; l < mesh.detail.lods.size(); ++l)
+                triangles[l] += mesh.detail.lods[l].indexCount / 3;
+        }
+        std::cout << "Model:: LOD triangles";
+        for (const size_t count : triangles)
+            std::cout << " " << count;
+        std::cout << std::endl;
     }
-    
-    m_directory = path.substr(0, path.find_last_of('/'));
 
     // recursively
-    processNode(scene->mRootNode, scene);
+    data.nodes.clear();
+    processNode(scene->mRootNode, -1, data.nodes);
+    return true;
 }
 
-void Model::processNode(aiNode *node, const aiScene *scene)
+void Model::processNode(aiNode *node, const int parent, std::vector<cache::Node>& nodes)
 {
+    const int self = (int)nodes.size();
+    nodes.push_back({ parent, glm::transpose(glm::make_mat4(&node->mTransformation.a1)), {} });
+
     for (unsigned int i = 0; i < node->mNumMeshes; ++i)
-    {
-        aiMesh *mesh = scene->mMeshes[node->mMeshes[i]];
-        m_meshes.push_back(processMesh(mesh, scene));
-    }
+        nodes[self].meshes.push_back(node->mMeshes[i]);
     
     for (unsigned int i = 0; i < node->mNumChildren; ++i)
     {
-        processNode(node->mChildren[i], scene);
+        processNode(node->mChildren[i], self, nodes);
     }
 }
 
-Mesh Model::processMesh(aiMesh *mesh, const aiScene *scene)
+MeshData Model::processMesh(aiMesh *mesh, const aiScene *scene)
 {
     // data to fill
     std::vector<Vertex> vertices;
     std::vector<unsigned int> indices;
     std::vector<Texture> textures;
+    unsigned int attributes = 1u << ePOSITION;
+    if (mesh->HasNormals())
+        attributes |= 1u << eNORMAL;
+    if (mesh->mTextureCoords[0])
+        attributes |= 1u << eTEXCOORDS;
+    vertices.reserve(mesh->mNumVertices);
+    indices.reserve(mesh->mNumFaces * 3);
 
     // vertices
     for (unsigned int i = 0; i < mesh->mNumVertices; i++)
     {
-        Vertex vertex;
+        Vertex vertex = {}; // bones and tangents stay 0 unless filled later
 
         // positions
         glm::vec3 vector; 
@@ -143,19 +532,7 @@ Mesh Model::processMesh(aiMesh *mesh, const aiScene *scene)
             vec.x = mesh->mTextureCoords[0][i].x;
             vec.y = mesh->mTextureCoords[0][i].y;
             vertex.TexCoords = vec;
-            // tangent
-            vector.x = mesh->mTangents[i].x;
-            vector.y = mesh->mTangents[i].y;
-            vector.z = mesh->mTangents[i].z;
-            vertex.Tangent = vector;
-            // bitangent
-            vector.x = mesh->mBitangents[i].x;
-            vector.y = mesh->mBitangents[i].y;
-            vector.z = mesh->mBitangents[i].z;
-            vertex.Bitangent = vector;
         }
-        else
-            vertex.TexCoords = glm::vec2(0.0f, 0.0f);
 
         vertices.push_back(vertex);
     }
@@ -170,7 +547,20 @@ Mesh Model::processMesh(aiMesh *mesh, const aiScene *scene)
     }
     
     // process materials
-    aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex];
+    textures = materialTextures(scene->mMaterials[mesh->mMaterialIndex]);
+
+    // return the extracted mesh data, detail is filled by importScene
+    MeshData data;
+    data.vertices   = std::move(vertices);
+    data.indices    = std::move(indices);
+    data.textures   = std::move(textures);
+    data.attributes = attributes;
+    return data;
+}
+
+std::vector<Texture> Model::materialTextures(aiMaterial *material)
+{
+    std::vector<Texture> textures;
     // we assume a convention for sampler names in the shaders. Each diffuse texture should be named
     // as 'texture_diffuseN' where N is a sequential number ranging from 1 to MAX_SAMPLER_NUMBER.
     // Same applies to other texture as the following list summarizes:
@@ -190,11 +580,10 @@ Mesh Model::processMesh(aiMesh *mesh, const aiScene *scene)
     // height maps
     std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
     textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
-
-    // return a mesh object created from the extracted mesh data
-    return Mesh(vertices, indices, textures);
+    return textures;
 }
 
+// names only, ids are resolved by loadMaterialTexture in the gl phase
 std::vector<Texture> Model::loadMaterialTextures(aiMaterial *mat, const aiTextureType type, const std::string typeName)
 {
     std::vector<Texture> textures;
@@ -202,68 +591,55 @@ std::vector<Texture> Model::loadMaterialTextures(aiMaterial *mat, const aiTextur
     {
         aiString str;// file name
         mat->GetTexture(type, i, &str);
-        // check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-        bool skip = false;
-        for (unsigned int j = 0; j < m_texLoaded.size(); j++)
-        {
-            if (std::strcmp(m_texLoaded[j].name.data(), str.C_Str()) == 0)
-            {
-                textures.push_back(m_texLoaded[j]);
-                skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
-                break;
-            }
-        }
-        if (!skip)
-        { // if texture hasn't been loaded already, load it
-            Texture texture;
-            texture.id = TextureLoader::loadTexture(str.C_Str(), this->m_directory);
-            texture.type = typeName;
-            texture.name = str.C_Str();
-            textures.push_back(texture);
-            m_texLoaded.push_back(texture); // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
-        }
+        textures.push_back({ 0, typeName, str.C_Str() });
     }
     return textures;
 }
 
-unsigned int TextureLoader::loadTexture(const char* name, const std::string& directory, bool gamma)
+void Model::preloadTextures(const std::vector<Texture>& textures)
 {
-    std::string filename = std::string(name);
-    filename = directory + '/' + filename;
+    // every name once, skipping what this model already holds
+    std::vector<Texture> pending;
+    std::vector<std::string> paths;
+    std::vector<bool> srgb;
+    for (const Texture& texture : textures)
+    {
+        if (m_texLoaded.count(texture.name))
+            continue;
 
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
+        const std::string path = TextureCache::resolve(m_directory, texture.name);
+        if (std::find(paths.begin(), paths.end(), path) != paths.end())
+            continue;
 
-    int width, height, nrComponents;
-    unsigned char* data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-    if (data)
-    {
-        GLenum format;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
+        pending.push_back(texture);
+        paths.push_back(path);
+        srgb.push_back(TextureLoader::srgb(texture.type));
     }
-    else
+
+    // shared with every other model, decoded concurrently and uploaded as one batch if missing
+    const std::vector<unsigned int> ids = TextureCache::instance().acquire(paths, &m_texTimings, &srgb);
+    for (size_t i = 0; i < pending.size(); ++i)
     {
-        std::cout << "Texture failed to load at name: " << name << std::endl;
-        stbi_image_free(data);
+        pending[i].id = ids[i];
+        m_texLoaded[pending[i].name] = pending[i];
     }
+}
 
-    return textureID;
+Texture Model::loadMaterialTexture(const std::string& name, const std::string& typeName)
+{
+    // check if texture was loaded before and if so, skip loading a new texture
+    auto found = m_texLoaded.find(name);
+    if (found != m_texLoaded.end())
+        return found->second; // a texture with the same filepath has already been loaded. (optimization)
+
+    // if texture hasn't been loaded already, load it
+    Texture texture;
+    const std::vector<bool> srgb = { TextureLoader::srgb(typeName) };
+    texture.id = TextureCache::instance().acquire({ TextureCache::resolve(m_directory, name) }, nullptr, &srgb)[0];
+    texture.type = typeName;
+    texture.name = name;
+    m_texLoaded[name] = texture; // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
+    return texture;
 }
 
 } // namespace model
@@ -0,0 +1,335 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "model/bounds.h"
+#include "model/vertexFormat.h"
+#include "util/threadPool.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+/*
+Software occlusion culling, no gpu and no readback:
+
+    * a WIDTH x HEIGHT depth buffer (window depth, cleared to 1) that a few large occluders are rasterized into
+      on the cpu. Triangles are clipped against the near plane, then set up once: 3 edge functions and a depth
+      plane, evaluated at pixel centers. Both faces are drawn
+    * the buffer is split in TILE_WIDTH x TILE_HEIGHT tiles, triangles are binned to the tiles they touch and each
+      tile is rasterized by one util::defaultPool() job, so no two jobs write the same pixel
+    * rows are filled 4 pixels per step with SSE2 (edge tests and depth min), scalar on other architectures
+    * the pyramid (Hi-Z): each level keeps the farthest depth of 2x2 texels of the one below. A box is hidden when
+      its nearest corner is behind the farthest occluder depth over the texels its screen rectangle covers, on
+      the level where that is at most 2x2 texels. Boxes crossing the near plane are always visible
+    * coverage is sampled at pixel centers: a gap between occluders narrower than a pixel may be closed
+*/
+
+namespace model
+{
+
+class OcclusionBuffer
+{
+public:
+    static const unsigned int WIDTH  = 256;
+    static const unsigned int HEIGHT = 128;
+
+    // level 0 triangles of a mesh that kept its geometry, placed by [world]
+    struct Occluder
+    {
+        const Vertex*       vertices;
+        const unsigned int* indices;
+        size_t              triangleCount;
+        glm::mat4           world;
+    };
+
+    // clears, rasterizes [occluders] as seen through [viewProjection] and builds the pyramid
+    void render(const glm::mat4& viewProjection, const std::vector<Occluder>& occluders);
+    // world space, false: hidden behind the occluders of the last render()
+    bool visible(const Aabb& box) const;
+
+    // WIDTH x HEIGHT, bottom row first, empty before the first render()
+    const std::vector<float>& depth() const { return m_levels.empty() ? m_empty : m_levels[0]; }
+
+private:
+    enum { TILE_WIDTH = 64, TILE_HEIGHT = 32, TILES_X = 4, TILES_Y = 4 };
+
+    // set up in screen space, pixel (x, y) is covered when every edge is >= 0 at (x + 0.5, y + 0.5)
+    struct Triangle
+    {
+        float edge[3][3];  // a, b, c of a * x + b * y + c
+        float depth[3];    // z = depth[0] * x + depth[1] * y + depth[2]
+        int   box[4];      // covered pixels, inclusive: min x, min y, max x, max y
+    };
+
+    // per occluder, written by its own setup job
+    struct Work
+    {
+        std::vector<glm::vec4>  clip;
+        std::vector<Triangle>   triangles;
+        std::vector<uint32_t>   bins[TILES_X * TILES_Y];
+    };
+
+    void setup(const Occluder& occluder, Work& work) const;
+    void addTriangle(const glm::vec4& a, const glm::vec4& b, const glm::vec4& c, Work& work) const;
+    void rasterize(const Triangle& triangle, const int x0, const int y0, const int x1, const int y1);
+    void buildPyramid();
+
+private:
+    glm::mat4 m_viewProjection = glm::mat4(1.0f);
+    std::vector<Work> m_work;
+    std::vector<std::vector<float>> m_levels; // level 0 is the depth buffer
+    std::vector<float> m_empty;
+};
+
+//////////////////// IMPLEMENTATION ////////////////////
+
+inline void OcclusionBuffer::render(const glm::mat4& viewProjection, const std::vector<Occluder>& occluders)
+{
+    m_viewProjection = viewProjection;
+    m_levels.resize(1);
+    m_levels[0].assign(WIDTH * HEIGHT, 1.0f);
+
+    // setup per occluder, then raster per tile
+    if (m_work.size() < occluders.size())
+        m_work.resize(occluders.size());
+    util::ThreadPool& pool = util::defaultPool();
+    pool.parallelFor(occluders.size(), [&](const size_t i)
+    {
+        setup(occluders[i], m_work[i]);
+    });
+    pool.parallelFor(TILES_X * TILES_Y, [&](const size_t tile)
+    {
+        const int x0 = (int)(tile % TILES_X) * TILE_WIDTH, y0 = (int)(tile / TILES_X) * TILE_HEIGHT;
+        for (size_t i = 0; i < occluders.size(); ++i)
+        {
+            const Work& work = m_work[i];
+            for (const uint32_t index : work.bins[tile])
+                rasterize(work.triangles[index], x0, y0, x0 + TILE_WIDTH - 1, y0 + TILE_HEIGHT - 1);
+        }
+    });
+
+    buildPyramid();
+}
+
+inline void OcclusionBuffer::setup(const Occluder& occluder, Work& work) const
+{
+    work.triangles.clear();
+    for (std::vector<uint32_t>& bin : work.bins)
+        bin.clear();
+
+    const glm::mat4 matrix = m_viewProjection * occluder.world;
+    const size_t vertexCount = occluder.triangleCount ? *std::max_element(occluder.indices, occluder.indices + occluder.triangleCount * 3) + 1 : 0;
+    work.clip.resize(vertexCount);
+    for (size_t i = 0; i < vertexCount; ++i)
+        work.clip[i] = matrix * glm::vec4(occluder.vertices[i].Position, 1.0f);
+
+    for (size_t t = 0; t < occluder.triangleCount; ++t)
+    {
+        const glm::vec4* v[3] = { &work.clip[occluder.indices[t * 3]], &work.clip[occluder.indices[t * 3 + 1]], &work.clip[occluder.indices[t * 3 + 2]] };
+
+        // all three outside one side plane, or in front of the near plane
+        bool outside = false;
+        for (int axis = 0; axis < 2 && !outside; ++axis)
+        {
+            outside = ((*v[0])[axis] > v[0]->w && (*v[1])[axis] > v[1]->w && (*v[2])[axis] > v[2]->w) ||
+                      ((*v[0])[axis] < -v[0]->w && (*v[1])[axis] < -v[1]->w && (*v[2])[axis] < -v[2]->w);
+        }
+        int behind = 0;
+        for (int k = 0; k < 3; ++k)
+            behind += v[k]->z < -v[k]->w;
+        if (outside || behind == 3)
+            continue;
+        if (behind == 0)
+        {
+            addTriangle(*v[0], *v[1], *v[2], work);
+            continue;
+        }
+
+        // clipped by the near plane: a triangle or a quad left
+        glm::vec4 polygon[4];
+        int count = 0;
+        for (int k = 0; k < 3; ++k)
+        {
+            const glm::vec4& a = *v[k];
+            const glm::vec4& b = *v[(k + 1) % 3];
+            const float da = a.z + a.w, db = b.z + b.w;
+            if (da >= 0.0f)
+                polygon[count++] = a;
+            if ((da >= 0.0f) != (db >= 0.0f))
+                polygon[count++] = a + (b - a) * (da / (da - db));
+        }
+        for (int k = 1; k + 1 < count; ++k)
+            addTriangle(polygon[0], polygon[k], polygon[k + 1], work);
+    }
+}
+
+inline void OcclusionBuffer::addTriangle(const glm::vec4& a, const glm::vec4& b, const glm::vec4& c, Work& work) const
+{
+    // window coordinates, pixels
+    glm::vec3 p[3];
+    const glm::vec4* clip[3] = { &a, &b, &c };
+    for (int k = 0; k < 3; ++k)
+    {
+        const glm::vec3 ndc = glm::vec3(*clip[k]) / clip[k]->w;
+        p[k] = glm::vec3((ndc.x * 0.5f + 0.5f) * WIDTH, (ndc.y * 0.5f + 0.5f) * HEIGHT, ndc.z * 0.5f + 0.5f);
+    }
+
+    // both faces: counter clockwise from here on
+    float area = (p[1].x - p[0].x) * (p[2].y - p[0].y) - (p[2].x - p[0].x) * (p[1].y - p[0].y);
+    if (std::fabs(area) < 1e-8f)
+        return;
+    if (area < 0.0f)
+    {
+        std::swap(p[1], p[2]);
+        area = -area;
+    }
+
+    Triangle triangle;
+    const float minX = std::min(p[0].x, std::min(p[1].x, p[2].x)), maxX = std::max(p[0].x, std::max(p[1].x, p[2].x));
+    const float minY = std::min(p[0].y, std::min(p[1].y, p[2].y)), maxY = std::max(p[0].y, std::max(p[1].y, p[2].y));
+    triangle.box[0] = std::max(0, (int)std::ceil(minX - 0.5f));
+    triangle.box[1] = std::max(0, (int)std::ceil(minY - 0.5f));
+    triangle.box[2] = std::min((int)WIDTH - 1, (int)std::floor(maxX - 0.5f));
+    triangle.box[3] = std::min((int)HEIGHT - 1, (int)std::floor(maxY - 0.5f));
+    if (triangle.box[0] > triangle.box[2] || triangle.box[1] > triangle.box[3])
+        return;
+
+    for (int k = 0; k < 3; ++k)
+    {
+        const glm::vec3& from = p[k];
+        const glm::vec3& to = p[(k + 1) % 3];
+        triangle.edge[k][0] = from.y - to.y;
+        triangle.edge[k][1] = to.x - from.x;
+        triangle.edge[k][2] = -(triangle.edge[k][0] * from.x + triangle.edge[k][1] * from.y);
+    }
+    const float dx1 = p[1].x - p[0].x, dy1 = p[1].y - p[0].y, dz1 = p[1].z - p[0].z;
+    const float dx2 = p[2].x - p[0].x, dy2 = p[2].y - p[0].y, dz2 = p[2].z - p[0].z;
+    triangle.depth[0] = (dz1 * dy2 - dz2 * dy1) / area;
+    triangle.depth[1] = (dz2 * dx1 - dz1 * dx2) / area;
+    triangle.depth[2] = p[0].z - triangle.depth[0] * p[0].x - triangle.depth[1] * p[0].y;
+
+    const uint32_t index = (uint32_t)work.triangles.size();
+    work.triangles.push_back(triangle);
+    for (int ty = triangle.box[1] / TILE_HEIGHT; ty <= triangle.box[3] / TILE_HEIGHT; ++ty)
+        for (int tx = triangle.box[0] / TILE_WIDTH; tx <= triangle.box[2] / TILE_WIDTH; ++tx)
+            work.bins[ty * TILES_X + tx].push_back(index);
+}
+
+inline void OcclusionBuffer::rasterize(const Triangle& triangle, const int x0, const int y0, const int x1, const int y1)
+{
+    // rows start on a multiple of 4, tiles are too, so the extra lanes stay inside the tile and the edge tests reject them
+    const int left = std::max(x0, triangle.box[0]) & ~3, right = std::min(x1, triangle.box[2]);
+    const int bottom = std::max(y0, triangle.box[1]), top = std::min(y1, triangle.box[3]);
+    float* depth = m_levels[0].data();
+
+#if defined(OGL_BOUNDS_AVX) || defined(OGL_BOUNDS_SSE2)
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 lanes = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+    const __m128 a0 = _mm_set1_ps(triangle.edge[0][0]), a1 = _mm_set1_ps(triangle.edge[1][0]), a2 = _mm_set1_ps(triangle.edge[2][0]);
+    const __m128 dzdx = _mm_set1_ps(triangle.depth[0]);
+    for (int y = bottom; y <= top; ++y)
+    {
+        const float cy = y + 0.5f;
+        const __m128 c0 = _mm_set1_ps(triangle.edge[0][1] * cy + triangle.edge[0][2]);
+        const __m128 c1 = _mm_set1_ps(triangle.edge[1][1] * cy + triangle.edge[1][2]);
+        const __m128 c2 = _mm_set1_ps(triangle.edge[2][1] * cy + triangle.edge[2][2]);
+        const __m128 cz = _mm_set1_ps(triangle.depth[1] * cy + triangle.depth[2]);
+        float* row = depth + y * WIDTH;
+        for (int x = left; x <= right; x += 4)
+        {
+            const __m128 cx = _mm_add_ps(_mm_set1_ps((float)x), lanes);
+            __m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a0, cx), c0), zero);
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a1, cx), c1), zero));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a2, cx), c2), zero));
+            if (_mm_movemask_ps(inside) == 0)
+                continue;
+            const __m128 old = _mm_loadu_ps(row + x);
+            const __m128 z = _mm_min_ps(old, _mm_add_ps(_mm_mul_ps(dzdx, cx), cz));
+            _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, z), _mm_andnot_ps(inside, old)));
+        }
+    }
+#else
+    for (int y = bottom; y <= top; ++y)
+    {
+        const float cy = y + 0.5f;
+        float* row = depth + y * WIDTH;
+        for (int x = left; x <= right; ++x)
+        {
+            const float cx = x + 0.5f;
+            bool inside = true;
+            for (int k = 0; k < 3 && inside; ++k)
+                inside = triangle.edge[k][0] * cx + triangle.edge[k][1] * cy + triangle.edge[k][2] >= 0.0f;
+            if (inside)
+                row[x] = std::min(row[x], triangle.depth[0] * cx + triangle.depth[1] * cy + triangle.depth[2]);
+        }
+    }
+#endif
+}
+
+inline void OcclusionBuffer::buildPyramid()
+{
+    unsigned int width = WIDTH, height = HEIGHT;
+    while (width > 1 || height > 1)
+    {
+        const std::vector<float>& below = m_levels.back();
+        const unsigned int w = std::max(1u, width / 2), h = std::max(1u, height / 2);
+        std::vector<float> level(w * h);
+        for (unsigned int y = 0; y < h; ++y)
+        {
+            const unsigned int y0 = std::min(y * 2, height - 1), y1 = std::min(y * 2 + 1, height - 1);
+            for (unsigned int x = 0; x < w; ++x)
+            {
+                const unsigned int x0 = std::min(x * 2, width - 1), x1 = std::min(x * 2 + 1, width - 1);
+                level[y * w + x] = std::max(std::max(below[y0 * width + x0], below[y0 * width + x1]),
+                                            std::max(below[y1 * width + x0], below[y1 * width + x1]));
+            }
+        }
+        m_levels.push_back(std::move(level));
+        width = w;
+        height = h;
+    }
+}
+
+inline bool OcclusionBuffer::visible(const Aabb& box) const
+{
+    if (m_levels.empty())
+        return true;
+
+    float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX, nearest = FLT_MAX;
+    for (int corner = 0; corner < 8; ++corner)
+    {
+        const glm::vec3 p(corner & 1 ? box.max.x : box.min.x, corner & 2 ? box.max.y : box.min.y, corner & 4 ? box.max.z : box.min.z);
+        const glm::vec4 clip = m_viewProjection * glm::vec4(p, 1.0f);
+        if (clip.z < -clip.w || clip.w <= 0.0f)
+            return true;
+        const glm::vec3 ndc = glm::vec3(clip) / clip.w;
+        minX = std::min(minX, ndc.x);
+        maxX = std::max(maxX, ndc.x);
+        minY = std::min(minY, ndc.y);
+        maxY = std::max(maxY, ndc.y);
+        nearest = std::min(nearest, ndc.z * 0.5f + 0.5f);
+    }
+
+    // every pixel the rectangle touches, off screen parts are the frustum's business
+    const int x0 = std::max(0, (int)std::floor((minX * 0.5f + 0.5f) * WIDTH));
+    const int y0 = std::max(0, (int)std::floor((minY * 0.5f + 0.5f) * HEIGHT));
+    const int x1 = std::min((int)WIDTH - 1, (int)std::floor((maxX * 0.5f + 0.5f) * WIDTH));
+    const int y1 = std::min((int)HEIGHT - 1, (int)std::floor((maxY * 0.5f + 0.5f) * HEIGHT));
+    if (x0 > x1 || y0 > y1)
+        return true;
+
+    unsigned int level = 0;
+    while (level + 1 < m_levels.size() && ((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1))
+        ++level;
+    const unsigned int width = std::max(1u, WIDTH >> level);
+    float farthest = 0.0f;
+    for (int y = y0 >> level; y <= y1 >> level; ++y)
+        for (int x = x0 >> level; x <= x1 >> level; ++x)
+            farthest = std::max(farthest, m_levels[level][y * width + x]);
+    return nearest <= farthest;
+}
+
+} // namespace model
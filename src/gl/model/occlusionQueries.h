@@ -0,0 +1,252 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "model/bounds.h"
+#include "model/mesh.h"
+#include "shaderManager/ShaderManager.h"
+
+#include <vector>
+
+/*
+Hardware occlusion queries, the gpu side counterpart of OcclusionBuffer:
+
+    * instances left visible by the culler get a GL_ANY_SAMPLES_PASSED query around their world box, drawn after
+      the meshes with color and depth writes off, so it tests against the finished depth. At most
+      CullSettings::queriesPerFrame boxes are drawn a frame, up to half for held back instances, the rest for the
+      visible ones, both in turns, so a scene of many instances costs a bounded number of small draws and keeps its instanced runs
+    * results are read a frame or more later, only once GL_QUERY_RESULT_AVAILABLE says so: nothing waits on the gpu.
+      An instance whose query is still in flight is drawn as usual and gets no new one
+    * an instance whose last result found no sample is taken out of the normal draws (and of its instanced run),
+      as long as the budget allows: its box is queried first, then it is drawn inside
+      glBeginConditionalRender(GL_QUERY_NO_WAIT), so the gpu drops the draw when the box stays hidden and draws it
+      anyway when the result is late. Over the budget it is drawn as usual until its next turn
+    * boxes are a unit cube placed by "model" and drawn with the model's own program, the fragment output is masked.
+      They are pulled towards the eye by a polygon offset and pass equal depths: a mesh filling its box (a face
+      on the box) must not hide it. Boxes reaching in front of the near plane are never held back, their query would miss
+    * DrawStats::queryDraws counts the conditional draws, DrawStats::drawsSkipped those of earlier frames the gpu
+      dropped, as their results come in
+*/
+
+namespace model
+{
+
+class OcclusionQueries
+{
+public:
+    OcclusionQueries() = default;
+    OcclusionQueries(const OcclusionQueries&) = delete;
+    OcclusionQueries& operator=(const OcclusionQueries&) = delete;
+    ~OcclusionQueries() { release(); }
+
+    void release();
+
+    // before the draws, after culling: reads the results that are in and takes the instances they found
+    // hidden out of [culler]'s runs
+    void begin(MeshCuller& culler, const WorldView& view, DrawStats* stats = nullptr);
+    // after the draws, with [shader] in use: queries the drawn instances, then draw(instance) for every one begin()
+    // took out, each under the query of its box
+    template <typename Draw>
+    void end(ShaderManager& shader, const MeshCuller& culler, Draw&& draw);
+
+private:
+    void createBox();
+    void query(ShaderManager& shader, const unsigned int instance, const Aabb& box);
+
+private:
+    unsigned int m_vao = 0;
+    unsigned int m_vbo = 0;
+    unsigned int m_ebo = 0;
+
+    // per instance
+    std::vector<GLuint>        m_queries;   // 0 until first used
+    std::vector<unsigned char> m_pending;   // issued, result not read yet
+    std::vector<unsigned char> m_hidden;    // last result read: no sample passed
+    std::vector<unsigned char> m_conditional; // the pending query gates a draw
+
+    std::vector<unsigned int>  m_held;      // taken out by begin(), drawn by end()
+    size_t                     m_next = 0;     // instance the next turn of queries starts at
+    size_t                     m_nextHeld = 0; // of held back instances
+};
+
+//////////////////// IMPLEMENTATION ////////////////////
+
+inline void OcclusionQueries::release()
+{
+    for (const GLuint query : m_queries)
+    {
+        if (query)
+            glDeleteQueries(1, &query);
+    }
+    m_queries.clear();
+    m_pending.clear();
+    m_hidden.clear();
+    m_conditional.clear();
+    m_held.clear();
+
+    if (m_vao)
+    {
+        glDeleteVertexArrays(1, &m_vao);
+        glDeleteBuffers(1, &m_vbo);
+        glDeleteBuffers(1, &m_ebo);
+    }
+    m_vao = m_vbo = m_ebo = 0;
+}
+
+inline void OcclusionQueries::createBox()
+{
+    glm::vec3 corners[8];
+    for (int corner = 0; corner < 8; ++corner)
+        corners[corner] = glm::vec3(corner & 1 ? 1.0f : 0.0f, corner & 2 ? 1.0f : 0.0f, corner & 4 ? 1.0f : 0.0f);
+    // two triangles per face, both faces are rasterized the same
+    const unsigned char indices[36] = { 0, 2, 1, 1, 2, 3,   4, 5, 6, 5, 7, 6,   0, 1, 4, 1, 5, 4,
+                                        2, 6, 3, 3, 6, 7,   0, 4, 2, 2, 4, 6,   1, 3, 5, 3, 7, 5 };
+
+    glGenVertexArrays(1, &m_vao);
+    glGenBuffers(1, &m_vbo);
+    glGenBuffers(1, &m_ebo);
+    glBindVertexArray(m_vao);
+    glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(ePOSITION);
+    glVertexAttribPointer(ePOSITION, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+    glBindVertexArray(0);
+}
+
+inline void OcclusionQueries::begin(MeshCuller& culler, const WorldView& view, DrawStats* stats)
+{
+    const size_t count = culler.size();
+    m_queries.resize(count, 0);
+    m_pending.resize(count, 0);
+    m_hidden.resize(count, 0);
+    m_conditional.resize(count, 0);
+
+    unsigned int skipped = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (!m_pending[i])
+            continue;
+        GLuint available = 0;
+        glGetQueryObjectuiv(m_queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            continue;
+        GLuint samples = 0;
+        glGetQueryObjectuiv(m_queries[i], GL_QUERY_RESULT, &samples);
+        m_hidden[i] = samples == 0;
+        skipped += m_conditional[i] && samples == 0;
+        m_pending[i] = 0;
+    }
+
+    const glm::mat4 viewProjection = view.projection * view.view;
+    // up to half the budget, in turns too: the other half keeps finding newly hidden instances
+    const size_t budget = MeshCuller::settings().queriesPerFrame;
+    const size_t heldBudget = budget - budget / 2;
+    m_held.clear();
+    size_t checked = 0;
+    for (; checked < count && m_held.size() < heldBudget; ++checked)
+    {
+        const unsigned int i = (unsigned int)((m_nextHeld + checked) % count);
+        if (!culler.visible(i) || !m_hidden[i] || m_pending[i])
+            continue;
+        const Aabb& box = culler.box(i);
+        bool inFront = true;
+        for (int corner = 0; corner < 8 && inFront; ++corner)
+        {
+            const glm::vec3 p(corner & 1 ? box.max.x : box.min.x, corner & 2 ? box.max.y : box.min.y, corner & 4 ? box.max.z : box.min.z);
+            const glm::vec4 clip = viewProjection * glm::vec4(p, 1.0f);
+            inFront = clip.z >= -clip.w && clip.w > 0.0f;
+        }
+        if (inFront)
+            m_held.push_back(i);
+    }
+    m_nextHeld = count ? (m_nextHeld + checked) % count : 0;
+    culler.hide(m_held);
+
+    if (stats)
+    {
+        stats->meshes -= (unsigned int)m_held.size();
+        stats->queryDraws += (unsigned int)m_held.size();
+        stats->drawsSkipped += skipped;
+    }
+}
+
+inline void OcclusionQueries::query(ShaderManager& shader, const unsigned int instance, const Aabb& box)
+{
+    if (!m_queries[instance])
+        glGenQueries(1, &m_queries[instance]);
+    shader.setMat4("model", glm::scale(glm::translate(glm::mat4(1.0f), box.min), box.max - box.min));
+    glBeginQuery(GL_ANY_SAMPLES_PASSED, m_queries[instance]);
+    glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_BYTE, (void*)0);
+    glEndQuery(GL_ANY_SAMPLES_PASSED);
+    m_pending[instance] = 1;
+}
+
+template <typename Draw>
+inline void OcclusionQueries::end(ShaderManager& shader, const MeshCuller& culler, Draw&& draw)
+{
+    if (!m_vao)
+        createBox();
+
+    GLboolean colorMask[4], depthMask;
+    GLint depthFunc;
+    glGetBooleanv(GL_COLOR_WRITEMASK, colorMask);
+    glGetBooleanv(GL_DEPTH_WRITEMASK, &depthMask);
+    glGetIntegerv(GL_DEPTH_FUNC, &depthFunc);
+    const GLboolean offset = glIsEnabled(GL_POLYGON_OFFSET_FILL);
+    GLfloat offsetFactor, offsetUnits;
+    glGetFloatv(GL_POLYGON_OFFSET_FACTOR, &offsetFactor);
+    glGetFloatv(GL_POLYGON_OFFSET_UNITS, &offsetUnits);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_FALSE);
+    glDepthFunc(GL_LEQUAL);
+    glEnable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(-1.0f, -4.0f);
+
+    // the box in place of the mesh: plain positions, packed.vs decodes them as is
+    shader.setBool("instanced", false);
+    shader.setVec3("positionOffset", glm::vec3(0.0f));
+    shader.setVec3("positionScale", glm::vec3(1.0f));
+    glBindVertexArray(m_vao);
+    // what the held ones left of the budget, visible instances in turns
+    const size_t count = culler.size();
+    const size_t budget = MeshCuller::settings().queriesPerFrame;
+    size_t queried = m_held.size();
+    size_t checked = 0;
+    for (; checked < count && queried < budget; ++checked)
+    {
+        const size_t i = (m_next + checked) % count;
+        if (!culler.visible(i) || m_pending[i])
+            continue;
+        query(shader, (unsigned int)i, culler.box(i));
+        m_conditional[i] = 0;
+        ++queried;
+    }
+    m_next = count ? (m_next + checked) % count : 0;
+    for (const unsigned int i : m_held)
+    {
+        query(shader, i, culler.box(i));
+        m_conditional[i] = 1;
+    }
+    glBindVertexArray(0);
+
+    glColorMask(colorMask[0], colorMask[1], colorMask[2], colorMask[3]);
+    glDepthMask(depthMask);
+    glDepthFunc(depthFunc);
+    glPolygonOffset(offsetFactor, offsetUnits);
+    if (!offset)
+        glDisable(GL_POLYGON_OFFSET_FILL);
+
+    for (const unsigned int i : m_held)
+    {
+        glBeginConditionalRender(m_queries[i], GL_QUERY_NO_WAIT);
+        draw(i);
+        glEndConditionalRender();
+    }
+}
+
+} // namespace model
@@ -0,0 +1,339 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "model/bounds.h"
+#include "model/instanceBuffer.h"
+#include "model/mesh.h"
+#include "model/meshBuffer.h"
+#include "model/occlusionQueries.h"
+#include "model/sceneGraph.h"
+#include "shaderManager/ShaderManager.h"
+
+#include <cfloat>
+#include <vector>
+
+/*
+How Model and AsyncModel draw their meshes, one SceneDraw each:
+
+    * the scene graph places nodes, every node reference of a mesh is an instance
+    * a draw places the moved nodes, culls the instances against the view (MeshCuller), optionally hides those
+      behind occluders or held back by occlusion queries, then draws the rest mesh by mesh: one instance alone
+      with its node's world matrix, several at once from the instance buffer
+    * the meshes and their shared buffer stay with the model and are passed to every call. A model still loading
+      passes the meshes uploaded so far, its instances only refer to those
+*/
+
+namespace model
+{
+
+class SceneDraw
+{
+public:
+    // meshes[mesh] drawn placed by graph().world(node)
+    void add(const unsigned int mesh, const unsigned int node) { m_instances.push_back({ mesh, node }); }
+    const std::vector<MeshInstance>& instances() const { return m_instances; }
+
+    // [buffer]: the meshes' shared buffer (UploadSettings::sharedBuffer), empty if each mesh has its own
+    void Draw(ShaderManager& shader, std::vector<Mesh>& meshes, const MeshBuffer& buffer);
+    void DrawDepth(ShaderManager& shader, std::vector<Mesh>& meshes, const MeshBuffer& buffer);
+    // see Model::DrawInstanced()
+    void DrawInstanced(ShaderManager& shader, std::vector<Mesh>& meshes, const MeshBuffer& buffer,
+                       const glm::mat4* transforms, const size_t count);
+    void DrawDepthInstanced(ShaderManager& shader, std::vector<Mesh>& meshes, const MeshBuffer& buffer,
+                            const glm::mat4* transforms, const size_t count);
+    // see Model::pick()
+    bool pick(const std::vector<Mesh>& meshes, const Ray& ray, PickHit& hit);
+
+    // see Model::setView()
+    void setView(const WorldView& view) { m_view = view; m_viewing = true; }
+    void clearView() { m_viewing = false; }
+    const DrawStats& drawStats() const { return m_drawStats; }
+
+    // see Model::setTransform()
+    void setTransform(const glm::mat4& transform) { m_graph.setTransform(transform); }
+    SceneGraph& graph() { return m_graph; }
+
+private:
+    // world matrices of moved nodes, then the instance boxes
+    void place(const std::vector<Mesh>& meshes);
+    // the instances m_culler left visible, mesh by mesh: one alone with its node's world matrix and [view] in its
+    // own space, several at once from m_instanceBuffer at the level of detail of the nearest
+    void drawVisible(ShaderManager& shader, std::vector<Mesh>& meshes, const WorldView* view,
+                     const bool depth, const bool bindBuffer, DrawStats* stats);
+    // DrawInstanced(): every node reference of a mesh in every visible copy at once
+    void drawCopies(ShaderManager& shader, std::vector<Mesh>& meshes, const MeshBuffer& buffer, const WorldView* view,
+                    const glm::mat4* transforms, const size_t count, const bool depth, DrawStats* stats);
+    // one mesh, "model" set already: [view] in mesh space for its meshlets and levels of detail
+    static void drawMesh(ShaderManager& shader, Mesh& mesh, const glm::mat4& world, const WorldView* view,
+                         const bool depth, const bool bindBuffer, DrawStats* stats);
+
+private:
+    SceneGraph                m_graph;
+    std::vector<MeshInstance> m_instances; // every node reference of a mesh
+    InstanceBuffer            m_instanceBuffer;
+
+    bool             m_viewing = false;
+    WorldView        m_view;
+    MeshCuller       m_culler;
+    OcclusionQueries m_queries;
+    DrawStats        m_drawStats;
+};
+
+//////////////////// IMPLEMENTATION ////////////////////
+
+inline void SceneDraw::Draw(ShaderManager& shader, std::vector<Mesh>& meshes, const MeshBuffer& buffer)
+{
+    m_drawStats = DrawStats();
+    place(meshes);
+    const WorldView* view = m_viewing ? &m_view : nullptr;
+    m_culler.cull(view ? &view->frustum : nullptr, &m_drawStats);
+    if (view && MeshCuller::settings().occlusion)
+        m_culler.occlude(meshes, m_instances, m_graph, *view, &m_drawStats);
+    // meshes hidden in earlier frames are drawn last, each only if its box passes
+    const bool queries = view && MeshCuller::settings().occlusionQueries;
+    if (queries)
+        m_queries.begin(m_culler, *view, &m_drawStats);
+
+    // a shared buffer is bound once for every mesh
+    const bool shared = !buffer.empty();
+    if (shared)
+        buffer.bind();
+    drawVisible(shader, meshes, view, false, !shared, &m_drawStats);
+    if (shared)
+        glBindVertexArray(0);
+    if (queries)
+    {
+        m_queries.end(shader, m_culler, [&](const unsigned int instance)
+        {
+            const glm::mat4& world = m_graph.world(m_instances[instance].node);
+            shader.setMat4("model", world);
+            drawMesh(shader, meshes[m_instances[instance].mesh], world, view, false, true, &m_drawStats);
+        });
+    }
+}
+
+inline void SceneDraw::DrawDepth(ShaderManager& shader, std::vector<Mesh>& meshes, const MeshBuffer& buffer)
+{
+    place(meshes);
+    const WorldView* view = m_viewing ? &m_view : nullptr;
+    m_culler.cull(view ? &view->frustum : nullptr);
+    if (view && MeshCuller::settings().occlusion)
+        m_culler.occlude(meshes, m_instances, m_graph, *view);
+
+    const bool shared = !buffer.empty();
+    if (shared)
+        buffer.bindDepth();
+    drawVisible(shader, meshes, view, true, !shared, nullptr);
+    if (shared)
+        glBindVertexArray(0);
+}
+
+inline void SceneDraw::DrawInstanced(ShaderManager& shader, std::vector<Mesh>& meshes, const MeshBuffer& buffer,
+                                     const glm::mat4* transforms, const size_t count)
+{
+    m_drawStats = DrawStats();
+    place(meshes);
+    drawCopies(shader, meshes, buffer, m_viewing ? &m_view : nullptr, transforms, count, false, &m_drawStats);
+}
+
+inline void SceneDraw::DrawDepthInstanced(ShaderManager& shader, std::vector<Mesh>& meshes, const MeshBuffer& buffer,
+                                          const glm::mat4* transforms, const size_t count)
+{
+    place(meshes);
+    drawCopies(shader, meshes, buffer, m_viewing ? &m_view : nullptr, transforms, count, true, nullptr);
+}
+
+inline bool SceneDraw::pick(const std::vector<Mesh>& meshes, const Ray& ray, PickHit& hit)
+{
+    place(meshes);
+    return m_culler.pick(meshes, m_instances, m_graph, ray, hit);
+}
+
+inline void SceneDraw::place(const std::vector<Mesh>& meshes)
+{
+    m_culler.place(meshes, m_instances, m_graph, m_graph.update());
+}
+
+inline void SceneDraw::drawVisible(ShaderManager& shader, std::vector<Mesh>& meshes, const WorldView* view,
+                                   const bool depth, const bool bindBuffer, DrawStats* stats)
+{
+    const std::vector<InstanceRun>& runs = m_culler.runs();
+    const std::vector<unsigned int>& order = m_culler.order();
+
+    // every instanced draw of the pass reads one upload
+    m_instanceBuffer.clear();
+    for (const InstanceRun& run : runs)
+    {
+        for (unsigned int i = run.first; run.count > 1 && i < run.first + run.count; ++i)
+            m_instanceBuffer.add(m_graph.world(m_instances[order[i]].node));
+    }
+    m_instanceBuffer.upload();
+
+    const glm::vec3 eye = view ? glm::vec3(glm::inverse(view->view)[3]) : glm::vec3(0.0f);
+    const glm::mat4* placed = nullptr;
+    bool instanced = false;
+    size_t firstInstance = 0;
+    for (const InstanceRun& run : runs)
+    {
+        Mesh& mesh = meshes[run.mesh];
+        if (run.count > 1)
+        {
+            if (!instanced)
+                shader.setBool("instanced", true);
+            instanced = true;
+
+            // levels of detail by the nearest instance, meshlets are not culled
+            CullView local;
+            const bool lod = view && !mesh.m_detail.lods.empty();
+            if (lod)
+            {
+                const glm::mat4* nearest = nullptr;
+                float nearestDistance = FLT_MAX;
+                for (unsigned int i = run.first; i < run.first + run.count; ++i)
+                {
+                    const glm::mat4& world = m_graph.world(m_instances[order[i]].node);
+                    const float distance = glm::distance(eye, glm::vec3(world * glm::vec4(mesh.m_detail.bounds.center, 1.0f)));
+                    if (distance < nearestDistance)
+                    {
+                        nearestDistance = distance;
+                        nearest = &world;
+                    }
+                }
+                local = view->local(*nearest);
+            }
+            if (depth)
+                mesh.DrawDepthInstanced(shader, m_instanceBuffer, firstInstance, (GLsizei)run.count, bindBuffer, lod ? &local : nullptr, stats);
+            else
+                mesh.DrawInstanced(shader, m_instanceBuffer, firstInstance, (GLsizei)run.count, bindBuffer, lod ? &local : nullptr, stats);
+            firstInstance += run.count;
+            continue;
+        }
+
+        if (instanced)
+            shader.setBool("instanced", false);
+        instanced = false;
+
+        // meshes of one node, or of nodes placed alike, share the uniform
+        const glm::mat4& world = m_graph.world(m_instances[order[run.first]].node);
+        if (!placed || world != *placed)
+        {
+            shader.setMat4("model", world);
+            placed = &world;
+        }
+
+        drawMesh(shader, mesh, world, view, depth, bindBuffer, stats);
+    }
+    if (instanced)
+        shader.setBool("instanced", false);
+}
+
+inline void SceneDraw::drawCopies(ShaderManager& shader, std::vector<Mesh>& meshes, const MeshBuffer& buffer, const WorldView* view,
+                                  const glm::mat4* transforms, const size_t count, const bool depth, DrawStats* stats)
+{
+    if (m_instances.empty())
+        return;
+
+    // node matrices below the model transform, each copy puts its own above them
+    const glm::mat4 root = glm::inverse(m_graph.transform());
+    std::vector<glm::mat4> relative(m_instances.size());
+    Aabb bounds{ glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX) };
+    for (size_t i = 0; i < m_instances.size(); ++i)
+    {
+        relative[i] = root * m_graph.world(m_instances[i].node);
+        const Aabb box = meshes[m_instances[i].mesh].m_detail.box.transformed(relative[i]);
+        bounds.min = glm::min(bounds.min, box.min);
+        bounds.max = glm::max(bounds.max, box.max);
+    }
+
+    // whole copies against the view, the nearest picks the levels of detail
+    std::vector<unsigned int> copies;
+    copies.reserve(count);
+    size_t nearest = 0;
+    float nearestDistance = FLT_MAX;
+    const glm::vec3 eye = view ? glm::vec3(glm::inverse(view->view)[3]) : glm::vec3(0.0f);
+    for (size_t k = 0; k < count; ++k)
+    {
+        const Aabb box = bounds.transformed(transforms[k]);
+        if (view && !view->frustum.intersects(box))
+            continue;
+        copies.push_back((unsigned int)k);
+        const float distance = glm::distance(eye, (box.min + box.max) * 0.5f);
+        if (distance < nearestDistance)
+        {
+            nearestDistance = distance;
+            nearest = k;
+        }
+    }
+    if (stats)
+    {
+        stats->meshes += (unsigned int)(copies.size() * m_instances.size());
+        stats->meshesCulled += (unsigned int)((count - copies.size()) * m_instances.size());
+    }
+    if (copies.empty())
+        return;
+
+    // references grouped by mesh, then per reference every visible copy
+    std::vector<unsigned int> first(meshes.size() + 1, 0), byMesh(m_instances.size());
+    for (const MeshInstance& instance : m_instances)
+        ++first[instance.mesh + 1];
+    for (size_t mesh = 0; mesh < meshes.size(); ++mesh)
+        first[mesh + 1] += first[mesh];
+    std::vector<unsigned int> next(first.begin(), first.end() - 1);
+    for (unsigned int i = 0; i < m_instances.size(); ++i)
+        byMesh[next[m_instances[i].mesh]++] = i;
+
+    m_instanceBuffer.clear();
+    for (const unsigned int i : byMesh)
+    {
+        for (const unsigned int k : copies)
+            m_instanceBuffer.add(transforms[k] * relative[i]);
+    }
+    m_instanceBuffer.upload();
+
+    const bool shared = !buffer.empty();
+    if (shared && depth)
+        buffer.bindDepth();
+    else if (shared)
+        buffer.bind();
+    shader.setBool("instanced", true);
+    size_t firstInstance = 0;
+    for (size_t mesh = 0; mesh < meshes.size(); ++mesh)
+    {
+        const size_t references = first[mesh + 1] - first[mesh];
+        if (references == 0)
+            continue;
+        Mesh& drawn = meshes[mesh];
+        CullView local;
+        const bool lod = view && !drawn.m_detail.lods.empty();
+        if (lod)
+            local = view->local(transforms[nearest] * relative[byMesh[first[mesh]]]);
+        const GLsizei instanceCount = (GLsizei)(references * copies.size());
+        if (depth)
+            drawn.DrawDepthInstanced(shader, m_instanceBuffer, firstInstance, instanceCount, !shared, lod ? &local : nullptr, stats);
+        else
+            drawn.DrawInstanced(shader, m_instanceBuffer, firstInstance, instanceCount, !shared, lod ? &local : nullptr, stats);
+        firstInstance += instanceCount;
+    }
+    shader.setBool("instanced", false);
+    if (shared)
+        glBindVertexArray(0);
+}
+
+inline void SceneDraw::drawMesh(ShaderManager& shader, Mesh& mesh, const glm::mat4& world, const WorldView* view,
+                                const bool depth, const bool bindBuffer, DrawStats* stats)
+{
+    // only meshlets and levels of detail need the view in mesh space
+    CullView local;
+    const bool cull = view && (!mesh.m_detail.meshlets.empty() || !mesh.m_detail.lods.empty());
+    if (cull)
+        local = view->local(world);
+    if (depth)
+        mesh.DrawDepth(shader, bindBuffer, cull ? &local : nullptr, stats);
+    else
+        mesh.Draw(shader, bindBuffer, cull ? &local : nullptr, stats);
+}
+
+} // namespace model
@@ -0,0 +1,203 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "util/threadPool.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+/*
+Scene graph: the node hierarchy of a model with one local transform per node.
+
+    * nodes are added parent first (the import's pre-order) and keep that index. The matrices live in
+      structure of arrays form in breadth first order instead, one contiguous run per depth, so a run only
+      reads the one above it. Adding nodes re-lays them out at the next update()
+    * setLocal() / setTransform() only flag the node (the roots), update() walks the runs from the shallowest
+      flagged one: a node is recomputed when it or its parent was, untouched subtrees cost one byte test per node
+    * runs of PARALLEL_NODES and more are split across util::defaultPool()
+    * world = transform * ... * parent local * local, transform places the whole graph (the model matrix)
+*/
+
+namespace model
+{
+
+class SceneGraph
+{
+public:
+    static const unsigned int PARALLEL_NODES = 4096;
+
+    // [parent] < the new node, -1 for a root. Returns the node
+    unsigned int add(const int parent, const glm::mat4& local);
+    void clear();
+    size_t size() const { return m_slot.size(); }
+
+    void setTransform(const glm::mat4& transform);
+    const glm::mat4& transform() const { return m_transform; }
+
+    void setLocal(const unsigned int node, const glm::mat4& local);
+    const glm::mat4& local(const unsigned int node) const { return m_local[m_slot[node]]; }
+    // as of the last update()
+    const glm::mat4& world(const unsigned int node) const { return m_world[m_slot[node]]; }
+
+    // world matrices of the flagged nodes and their subtrees, false when nothing moved
+    bool update();
+
+private:
+    void layout();
+    void flag(const uint32_t slot);
+    void updateRun(const size_t begin, const size_t end);
+
+private:
+    enum { NO_LEVEL = ~0u };
+
+    glm::mat4 m_transform = glm::mat4(1.0f);
+
+    // per node
+    std::vector<int>      m_parentNode;
+    std::vector<uint32_t> m_slot;
+
+    // per slot, breadth first once laid out
+    std::vector<int32_t>       m_parent; // slot, -1 for a root
+    std::vector<uint32_t>      m_depth;
+    std::vector<glm::mat4>     m_local;
+    std::vector<glm::mat4>     m_world;
+    std::vector<unsigned char> m_dirty;
+    std::vector<size_t>        m_levels;  // first slot of each depth, plus the end
+    bool                       m_laidOut = true;
+    uint32_t                   m_firstDirty = (uint32_t)NO_LEVEL; // shallowest flagged depth
+};
+
+//////////////////// IMPLEMENTATION ////////////////////
+
+inline unsigned int SceneGraph::add(const int parent, const glm::mat4& local)
+{
+    // appended as is, ordered by layout() before the next update
+    const uint32_t node = (uint32_t)m_slot.size();
+    const uint32_t depth = parent < 0 ? 0 : m_depth[m_slot[parent]] + 1;
+    m_parentNode.push_back(parent);
+    m_slot.push_back(node);
+    m_parent.push_back(parent < 0 ? -1 : (int32_t)m_slot[parent]);
+    m_depth.push_back(depth);
+    m_local.push_back(local);
+    m_world.push_back(local);
+    m_dirty.push_back(1);
+    m_laidOut = false;
+    return node;
+}
+
+inline void SceneGraph::clear()
+{
+    *this = SceneGraph();
+}
+
+inline void SceneGraph::setTransform(const glm::mat4& transform)
+{
+    // set every frame by most callers: only a change flags the roots
+    if (transform == m_transform)
+        return;
+    m_transform = transform;
+    for (uint32_t slot = 0; slot < m_parent.size(); ++slot)
+    {
+        if (m_parent[slot] < 0)
+            flag(slot);
+    }
+}
+
+inline void SceneGraph::setLocal(const unsigned int node, const glm::mat4& local)
+{
+    const uint32_t slot = m_slot[node];
+    m_local[slot] = local;
+    flag(slot);
+}
+
+inline void SceneGraph::flag(const uint32_t slot)
+{
+    m_dirty[slot] = 1;
+    m_firstDirty = std::min(m_firstDirty, m_depth[slot]);
+}
+
+inline void SceneGraph::layout()
+{
+    const size_t count = m_slot.size();
+
+    // counting sort by depth, stable: siblings stay in import order
+    uint32_t depths = 0;
+    for (uint32_t node = 0; node < count; ++node)
+        depths = std::max(depths, m_depth[m_slot[node]] + 1);
+    m_levels.assign(depths + 1, 0);
+    for (uint32_t node = 0; node < count; ++node)
+        ++m_levels[m_depth[m_slot[node]] + 1];
+    for (uint32_t d = 0; d < depths; ++d)
+        m_levels[d + 1] += m_levels[d];
+
+    std::vector<size_t> next(m_levels.begin(), m_levels.end() - 1);
+    std::vector<uint32_t> slot(count);
+    for (uint32_t node = 0; node < count; ++node)
+        slot[node] = (uint32_t)next[m_depth[m_slot[node]]]++;
+
+    std::vector<int32_t>   parent(count);
+    std::vector<uint32_t>  depth(count);
+    std::vector<glm::mat4> local(count);
+    for (uint32_t node = 0; node < count; ++node)
+    {
+        const uint32_t s = slot[node];
+        parent[s] = m_parentNode[node] < 0 ? -1 : (int32_t)slot[m_parentNode[node]];
+        depth[s] = m_depth[m_slot[node]];
+        local[s] = m_local[m_slot[node]];
+    }
+    m_parent.swap(parent);
+    m_depth.swap(depth);
+    m_local.swap(local);
+    m_slot.swap(slot);
+
+    m_world.assign(count, glm::mat4(1.0f));
+    m_dirty.assign(count, 1);
+    m_firstDirty = count ? 0u : (uint32_t)NO_LEVEL;
+    m_laidOut = true;
+}
+
+inline bool SceneGraph::update()
+{
+    if (!m_laidOut)
+        layout();
+    if (m_firstDirty == NO_LEVEL)
+        return false;
+
+    util::ThreadPool& pool = util::defaultPool();
+    const size_t CHUNK = 1024;
+    for (size_t d = m_firstDirty; d + 1 < m_levels.size(); ++d)
+    {
+        const size_t begin = m_levels[d], end = m_levels[d + 1];
+        if (end - begin < PARALLEL_NODES)
+        {
+            updateRun(begin, end);
+            continue;
+        }
+        pool.parallelFor((end - begin + CHUNK - 1) / CHUNK, [&](const size_t chunk)
+        {
+            updateRun(begin + chunk * CHUNK, std::min(end, begin + (chunk + 1) * CHUNK));
+        });
+    }
+
+    // nothing above the first flagged depth was
+    std::fill(m_dirty.begin() + m_levels[m_firstDirty], m_dirty.end(), (unsigned char)0);
+    m_firstDirty = NO_LEVEL;
+    return true;
+}
+
+inline void SceneGraph::updateRun(const size_t begin, const size_t end)
+{
+    // parents are one run up and done already, each slot writes only itself
+    for (size_t slot = begin; slot < end; ++slot)
+    {
+        const int32_t parent = m_parent[slot];
+        if (!m_dirty[slot] && (parent < 0 || !m_dirty[parent]))
+            continue;
+        m_world[slot] = (parent < 0 ? m_transform : m_world[parent]) * m_local[slot];
+        m_dirty[slot] = 1;
+    }
+}
+
+} // namespace model
@@ -0,0 +1,457 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <stbimage/stb_image.h>
+#define STB_IMAGE_IMPLEMENTATION
+#include <stbimage/stb_image.h>
+
+#include "model/dds.h"
+#include "model/mipmap.h"
+#include "util/hash.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+Texture loading in two steps:
+
+    * decode: stbi_load into CPU memory + the mip chain (model/mipmap.h), thread safe, runs on the thread pool
+    * upload: one glTexImage2D per level, has to run on the context thread
+
+    A <name>.dds baked by TextureCompressor (model/textureCompressor.h) next to the png is preferred: it carries
+    its own mip chain and goes to glCompressedTexImage2D as is, no png decode and no glGenerateMipmap.
+    Otherwise the first decode writes the pixels and their chain to <png>.mipcache, later ones read that back
+    (per color space, see srgb()). Either file is ignored once the png is newer.
+
+    TextureCache (model/textureCache.h) decodes whole batches concurrently and shares the uploads.
+*/
+
+namespace model
+{
+
+// decoded pixels
+struct Image
+{
+    int width = 0;
+    int height = 0;
+    int components = 0;
+    std::unique_ptr<unsigned char, void (*)(void*)> pixels{ nullptr, stbi_image_free };
+    std::vector<dds::Level> levels;   // mip levels 1..n, offsets into mips
+    std::vector<unsigned char> mips;
+    dds::Texture compressed; // used instead of pixels when it has levels
+
+    bool empty() const { return !pixels && compressed.levels.empty(); }
+};
+
+// per texture cost, in milliseconds
+struct TextureTiming
+{
+    std::string name;
+    int width = 0;
+    int height = 0;
+    int components = 0;
+    double decodeMs = 0.0;
+    double uploadMs = 0.0;
+};
+
+class TextureLoader
+{
+public:
+    // context thread, once before decoding: which block compressed formats the driver takes
+    static void detectFormats();
+    static bool supports(const dds::eFormat format);
+
+    // color maps are authored in srgb, their mips are filtered in linear space
+    static bool srgb(const std::string& typeName) { return typeName == "texture_diffuse"; }
+
+    // any thread
+    static Image decode(const std::string& filename, const bool srgb = false);
+    // context thread, 0 if the image is empty. Texels are stored as decoded: the shaders work on them unconverted,
+    // srgb only changes how decode() filters the mips
+    static unsigned int upload(const Image& image);
+    // context thread: texture [id] holds exactly what upload(image) would, every level read back and compared
+    static bool matches(const unsigned int id, const Image& image);
+
+    // 1x1 white, stands in for textures that are not uploaded yet
+    static unsigned int fallbackTexture();
+
+    static void printTimings(std::ostream& os, const std::vector<TextureTiming>& timings);
+
+private:
+    static GLenum pixelFormat(const int components);
+    static unsigned int uploadCompressed(const dds::Texture& texture);
+    static bool loadCompressed(const std::string& filename, Image& image);
+    // <filename>.mipcache, see decode()
+    static bool loadMipCache(const std::string& filename, const bool srgb, Image& image);
+    static bool writeMipCache(const std::string& filename, const bool srgb, const Image& image);
+
+    // native endian, followed by level 0 and levels 1..n as Mipmap::layout() places them
+    struct MipCacheHeader
+    {
+        char     magic[4];
+        uint32_t version;
+        int32_t  width;
+        int32_t  height;
+        int32_t  components;
+        uint32_t srgb;
+        uint64_t payloadHash; // everything after the header
+    };
+    static const uint32_t MIP_CACHE_VERSION = 2;
+
+    static std::atomic<bool> s_s3tc; // BC1 / BC3, an extension. RGTC (BC4 / BC5) is core since 3.0
+};
+
+//////////////////// IMPLEMENTATION ////////////////////
+
+inline std::atomic<bool> TextureLoader::s_s3tc{ false };
+
+inline double elapsedMs(const std::chrono::steady_clock::time_point begin)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+}
+
+inline void TextureLoader::detectFormats()
+{
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; ++i)
+    {
+        const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+        if (extension && std::string(extension) == "GL_EXT_texture_compression_s3tc")
+            s_s3tc = true;
+    }
+}
+
+inline bool TextureLoader::supports(const dds::eFormat format)
+{
+    if (format == dds::eBC1 || format == dds::eBC3)
+        return s_s3tc;
+    return format == dds::eBC4 || format == dds::eBC5;
+}
+
+inline bool TextureLoader::loadCompressed(const std::string& filename, Image& image)
+{
+    std::error_code error;
+    const std::filesystem::path source(filename);
+    const std::filesystem::path baked = std::filesystem::path(filename).replace_extension(".dds");
+    if (source == baked || !std::filesystem::exists(baked, error))
+        return false;
+
+    // a png edited after baking wins
+    const auto sourceTime = std::filesystem::last_write_time(source, error);
+    if (!error && std::filesystem::last_write_time(baked, error) < sourceTime)
+        return false;
+
+    if (!dds::read(baked.string(), image.compressed) || !supports(image.compressed.format))
+    {
+        image.compressed = dds::Texture();
+        return false;
+    }
+
+    image.width  = image.compressed.levels[0].width;
+    image.height = image.compressed.levels[0].height;
+    image.components = image.compressed.format == dds::eBC4 ? 1 : image.compressed.format == dds::eBC5 ? 2 :
+                       image.compressed.format == dds::eBC3 ? 4 : 3;
+    return true;
+}
+
+inline Image TextureLoader::decode(const std::string& filename, const bool srgb)
+{
+    Image image;
+    if (loadCompressed(filename, image))
+        return image;
+
+    if (loadMipCache(filename, srgb, image))
+        return image;
+
+    image.pixels.reset(stbi_load(filename.c_str(), &image.width, &image.height, &image.components, 0));
+    if (image.pixels)
+    {
+        Mipmap::build(image.pixels.get(), image.width, image.height, image.components, srgb, image.levels, image.mips);
+        writeMipCache(filename, srgb, image);
+    }
+    return image;
+}
+
+inline bool TextureLoader::loadMipCache(const std::string& filename, const bool srgb, Image& image)
+{
+    std::error_code error;
+    const std::string path = filename + ".mipcache";
+    if (!std::filesystem::exists(path, error))
+        return false;
+
+    // a png edited after caching wins
+    const auto sourceTime = std::filesystem::last_write_time(filename, error);
+    if (!error && std::filesystem::last_write_time(path, error) < sourceTime)
+        return false;
+
+    std::ifstream is(path, std::ios::binary | std::ios::ate);
+    if (!is)
+        return false;
+    std::vector<unsigned char> file((size_t)is.tellg());
+    is.seekg(0);
+    if (!is.read((char*)file.data(), (std::streamsize)file.size()))
+        return false;
+
+    MipCacheHeader header;
+    if (file.size() < sizeof(header))
+        return false;
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (std::memcmp(header.magic, "OGLM", 4) != 0 || header.version != MIP_CACHE_VERSION || header.srgb != (srgb ? 1u : 0u) ||
+        header.width <= 0 || header.height <= 0 || header.components < 1 || header.components > 4)
+        return false;
+
+    const size_t base = (size_t)header.width * header.height * header.components;
+    std::vector<dds::Level> levels;
+    const size_t mips = Mipmap::layout(header.width, header.height, header.components, 0, levels);
+    if (file.size() - sizeof(header) != base + mips || util::hash(file.data() + sizeof(header), base + mips) != header.payloadHash)
+        return false;
+
+    // freed by stbi_image_free like a decoded image, that is free()
+    unsigned char* pixels = (unsigned char*)std::malloc(base);
+    if (!pixels)
+        return false;
+    std::memcpy(pixels, file.data() + sizeof(header), base);
+    image.pixels.reset(pixels);
+    image.width      = header.width;
+    image.height     = header.height;
+    image.components = header.components;
+    image.levels     = std::move(levels);
+    image.mips.assign(file.begin() + sizeof(header) + base, file.end());
+    return true;
+}
+
+inline bool TextureLoader::writeMipCache(const std::string& filename, const bool srgb, const Image& image)
+{
+    const size_t base = (size_t)image.width * image.height * image.components;
+    std::vector<unsigned char> file(sizeof(MipCacheHeader) + base + image.mips.size());
+    std::memcpy(file.data() + sizeof(MipCacheHeader), image.pixels.get(), base);
+    std::copy(image.mips.begin(), image.mips.end(), file.begin() + sizeof(MipCacheHeader) + base);
+
+    MipCacheHeader header = {};
+    std::memcpy(header.magic, "OGLM", 4);
+    header.version     = MIP_CACHE_VERSION;
+    header.width       = image.width;
+    header.height      = image.height;
+    header.components  = image.components;
+    header.srgb        = srgb ? 1u : 0u;
+    header.payloadHash = util::hash(file.data() + sizeof(MipCacheHeader), file.size() - sizeof(MipCacheHeader));
+    std::memcpy(file.data(), &header, sizeof(header));
+
+    // write aside and swap, another decode never reads a half written file
+    const std::string path = filename + ".mipcache";
+    const std::string tmpPath = path + ".tmp";
+    {
+        std::ofstream os(tmpPath, std::ios::binary | std::ios::trunc);
+        os.write((const char*)file.data(), file.size());
+        if (!os)
+        {
+            std::cout << "ERROR::TEXTURE:: failed to write " << tmpPath << std::endl;
+            return false;
+        }
+    }
+    std::remove(path.c_str());
+    if (std::rename(tmpPath.c_str(), path.c_str()) != 0)
+    {
+        std::remove(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+inline unsigned int TextureLoader::upload(const Image& image)
+{
+    if (!image.compressed.levels.empty())
+        return uploadCompressed(image.compressed);
+    if (!image.pixels)
+        return 0;
+
+    const GLenum format = pixelFormat(image.components);
+
+    unsigned int textureID;
+    glGenTextures(1, &textureID);
+
+    glBindTexture(GL_TEXTURE_2D, textureID);
+
+    // levels are tightly packed, 3 component rows of odd width are not 4 byte aligned
+    GLint alignment = 4;
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, image.pixels.get());
+    if (image.levels.empty())
+        glGenerateMipmap(GL_TEXTURE_2D);
+    else
+    {
+        for (size_t i = 0; i < image.levels.size(); ++i)
+        {
+            const dds::Level& level = image.levels[i];
+            glTexImage2D(GL_TEXTURE_2D, (GLint)i + 1, format, level.width, level.height, 0, format, GL_UNSIGNED_BYTE, image.mips.data() + level.offset);
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)image.levels.size());
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+
+    // grey + alpha is stored as rg, the shaders sample it as it used to be loaded: grey in rgb, alpha in a
+    if (image.components == 2)
+    {
+        const GLint swizzle[4] = { GL_RED, GL_RED, GL_RED, GL_GREEN };
+        glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+    }
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    return textureID;
+}
+
+inline GLenum TextureLoader::pixelFormat(const int components)
+{
+    if (components == 1)
+        return GL_RED;
+    if (components == 2)
+        return GL_RG;
+    if (components == 3)
+        return GL_RGB;
+    return GL_RGBA;
+}
+
+inline bool TextureLoader::matches(const unsigned int id, const Image& image)
+{
+    const bool compressed = !image.compressed.levels.empty();
+    const GLenum format = pixelFormat(image.components);
+    if (image.empty() || (!compressed && (image.components < 1 || image.components > 4)))
+        return false;
+
+    GLint bound = 0, alignment = 4;
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &bound);
+    glGetIntegerv(GL_PACK_ALIGNMENT, &alignment);
+    glBindTexture(GL_TEXTURE_2D, id);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+    // level i: its size and the bytes upload() gave it
+    struct Level { int width; int height; const unsigned char* data; size_t size; };
+    std::vector<Level> levels;
+    if (compressed)
+    {
+        for (const dds::Level& level : image.compressed.levels)
+            levels.push_back({ level.width, level.height, image.compressed.data.data() + level.offset, level.size });
+    }
+    else
+    {
+        const size_t components = (size_t)image.components;
+        levels.push_back({ image.width, image.height, image.pixels.get(), (size_t)image.width * image.height * components });
+        for (const dds::Level& level : image.levels)
+            levels.push_back({ level.width, level.height, image.mips.data() + level.offset, (size_t)level.width * level.height * components });
+    }
+
+    // without mips of its own the driver generated them from level 0, and does so alike for both
+    GLint maxLevel = 0;
+    glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, &maxLevel);
+    bool same = compressed || !image.levels.empty() ? maxLevel == (GLint)levels.size() - 1 : true;
+    if (compressed && same)
+    {
+        GLint internalFormat = 0;
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &internalFormat);
+        same = (GLenum)internalFormat == dds::glFormat(image.compressed.format);
+    }
+
+    std::vector<unsigned char> texels;
+    for (size_t i = 0; same && i < levels.size(); ++i)
+    {
+        GLint width = 0, height = 0, compressedSize = 0;
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, (GLint)i, GL_TEXTURE_WIDTH, &width);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, (GLint)i, GL_TEXTURE_HEIGHT, &height);
+        if (compressed)
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, (GLint)i, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &compressedSize);
+        same = width == levels[i].width && height == levels[i].height && (!compressed || (size_t)compressedSize == levels[i].size);
+        if (!same)
+            break;
+
+        texels.resize(levels[i].size);
+        if (compressed)
+            glGetCompressedTexImage(GL_TEXTURE_2D, (GLint)i, texels.data());
+        else
+            glGetTexImage(GL_TEXTURE_2D, (GLint)i, format, GL_UNSIGNED_BYTE, texels.data());
+        same = std::memcmp(texels.data(), levels[i].data, levels[i].size) == 0;
+    }
+
+    glPixelStorei(GL_PACK_ALIGNMENT, alignment);
+    glBindTexture(GL_TEXTURE_2D, (GLuint)bound);
+    return same;
+}
+
+inline unsigned int TextureLoader::uploadCompressed(const dds::Texture& texture)
+{
+    unsigned int textureID;
+    glGenTextures(1, &textureID);
+    glBindTexture(GL_TEXTURE_2D, textureID);
+
+    // the whole chain is in the file
+    for (size_t i = 0; i < texture.levels.size(); ++i)
+    {
+        const dds::Level& level = texture.levels[i];
+        glCompressedTexImage2D(GL_TEXTURE_2D, (GLint)i, dds::glFormat(texture.format), level.width, level.height, 0,
+                               (GLsizei)level.size, texture.data.data() + level.offset);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)texture.levels.size() - 1);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, texture.levels.size() > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    return textureID;
+}
+
+inline unsigned int TextureLoader::fallbackTexture()
+{
+    static unsigned int textureID = 0;
+    if (textureID)
+        return textureID;
+
+    const unsigned char white[4] = { 255, 255, 255, 255 };
+    glGenTextures(1, &textureID);
+    glBindTexture(GL_TEXTURE_2D, textureID);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, white);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    return textureID;
+}
+
+inline void TextureLoader::printTimings(std::ostream& os, const std::vector<TextureTiming>& timings)
+{
+    const std::ios::fmtflags flags = os.flags();
+    const std::streamsize precision = os.precision();
+
+    double decodeMs = 0.0, uploadMs = 0.0;
+    os << std::fixed << std::setprecision(2);
+    for (const TextureTiming& t : timings)
+    {
+        os << std::setw(32) << std::left << t.name << std::right
+           << std::setw(6) << t.width << "x" << std::setw(5) << std::left << t.height << std::right
+           << " decode " << std::setw(8) << t.decodeMs << " ms"
+           << " upload " << std::setw(8) << t.uploadMs << " ms" << std::endl;
+        decodeMs += t.decodeMs;
+        uploadMs += t.uploadMs;
+    }
+    // decode sum is cpu time across all workers, not wall time
+    os << timings.size() << " textures, decode " << decodeMs << " ms, upload " << uploadMs << " ms" << std::endl;
+    os.flags(flags);
+    os.precision(precision);
+}
+
+} // namespace model
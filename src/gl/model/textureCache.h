@@ -0,0 +1,251 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include "model/texture.h"
+#include "util/hash.h"
+#include "util/threadPool.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+Process wide texture cache:
+
+    * keyed by the resolved path, every model that references a file shares one GL texture
+    * reference counted: acquire() adds a reference, release() drops one and deletes the texture with the last
+    * optional content dedup: decoded pixels are hashed, two files with identical images share one texture too.
+      A hash match is only shared once the resident texture is read back and found byte for byte the same
+
+    acquire() and release() call GL and belong to the context thread, contains() may be called from anywhere.
+*/
+
+namespace model
+{
+
+class TextureCache
+{
+public:
+    static TextureCache& instance();
+
+    // "dir/./a.png", "dir\a.png" and "dir/sub/../a.png" are one entry
+    static std::string resolve(const std::string& directory, const std::string& name);
+
+    // decodes the missing ones in parallel, then uploads them. ids follow [paths], one reference each.
+    // [srgb] follows [paths] too, see TextureLoader::srgb()
+    std::vector<unsigned int> acquire(const std::vector<std::string>& paths, std::vector<TextureTiming>* timings = nullptr,
+                                      const std::vector<bool>* srgb = nullptr);
+    // for images decoded elsewhere, [image] is only uploaded if [path] isn't resident
+    unsigned int acquire(const std::string& path, const Image& image);
+    void release(const unsigned int id);
+
+    bool contains(const std::string& path);
+    void setContentDedup(const bool enabled) { m_contentDedup = enabled; }
+
+    size_t textureCount();
+
+private:
+    TextureCache() = default;
+
+    // m_mutex held
+    bool addReference(const std::string& path, unsigned int& id);
+
+private:
+    struct Entry
+    {
+        unsigned int refs = 0;
+        uint64_t contentHash = 0;
+        std::vector<std::string> paths;
+    };
+
+    std::mutex m_mutex;
+    std::unordered_map<std::string, unsigned int> m_byPath;
+    std::unordered_map<uint64_t, unsigned int>    m_byContent;
+    std::unordered_map<unsigned int, Entry>       m_entries; // by GL id
+    bool m_contentDedup = false;
+};
+
+//////////////////// IMPLEMENTATION ////////////////////
+
+inline TextureCache& TextureCache::instance()
+{
+    static TextureCache cache;
+    return cache;
+}
+
+inline std::string TextureCache::resolve(const std::string& directory, const std::string& name)
+{
+    std::string path = (std::filesystem::path(directory) / name).lexically_normal().generic_string();
+#ifdef _WIN32
+    // case insensitive file system
+    for (char& c : path)
+        c = (char)std::tolower((unsigned char)c);
+#endif
+    return path;
+}
+
+inline bool TextureCache::contains(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_byPath.count(path) != 0;
+}
+
+inline size_t TextureCache::textureCount()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_entries.size();
+}
+
+inline bool TextureCache::addReference(const std::string& path, unsigned int& id)
+{
+    auto found = m_byPath.find(path);
+    if (found == m_byPath.end())
+        return false;
+
+    id = found->second;
+    ++m_entries[id].refs;
+    return true;
+}
+
+inline std::vector<unsigned int> TextureCache::acquire(const std::vector<std::string>& paths, std::vector<TextureTiming>* timings,
+                                                      const std::vector<bool>* srgb)
+{
+    std::vector<unsigned int> ids(paths.size(), 0);
+
+    // resident ones first, every missing path decoded once
+    std::vector<std::string> missing;
+    std::vector<bool> missingSrgb;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (size_t i = 0; i < paths.size(); ++i)
+        {
+            if (!addReference(paths[i], ids[i]) && std::find(missing.begin(), missing.end(), paths[i]) == missing.end())
+            {
+                missing.push_back(paths[i]);
+                missingSrgb.push_back(srgb && (*srgb)[i]);
+            }
+        }
+    }
+
+    std::vector<Image> images(missing.size());
+    std::vector<TextureTiming> timing(missing.size());
+    util::defaultPool().parallelFor(missing.size(), [&](const size_t i)
+    {
+        const auto begin = std::chrono::steady_clock::now();
+        images[i] = TextureLoader::decode(missing[i], missingSrgb[i]);
+        timing[i].decodeMs = elapsedMs(begin);
+    });
+
+    // upload in a batch, free every image as soon as the driver has its copy
+    for (size_t i = 0; i < missing.size(); ++i)
+    {
+        timing[i].name       = missing[i];
+        timing[i].width      = images[i].width;
+        timing[i].height     = images[i].height;
+        timing[i].components = images[i].components;
+
+        const auto begin = std::chrono::steady_clock::now();
+        const unsigned int id = acquire(missing[i], images[i]);
+        timing[i].uploadMs = elapsedMs(begin);
+        images[i] = Image();
+
+        // first occurrence keeps the reference taken by acquire(), duplicates add their own
+        bool first = true;
+        for (size_t j = 0; j < paths.size(); ++j)
+        {
+            if (ids[j] || paths[j] != missing[i])
+                continue;
+
+            ids[j] = id;
+            if (!first)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                ++m_entries[id].refs;
+            }
+            first = false;
+        }
+    }
+
+    if (timings)
+        timings->insert(timings->end(), timing.begin(), timing.end());
+    return ids;
+}
+
+inline unsigned int TextureCache::acquire(const std::string& path, const Image& image)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    unsigned int id = 0;
+    if (addReference(path, id))
+        return id;
+
+    uint64_t contentHash = 0;
+    if (m_contentDedup && !image.empty())
+    {
+        const int header[4] = { image.width, image.height, image.components, (int)image.compressed.format };
+        contentHash = util::hash(header, sizeof(header));
+        if (image.pixels)
+            contentHash = util::hash(image.pixels.get(), (size_t)image.width * image.height * image.components, contentHash);
+        else
+            contentHash = util::hash(image.compressed.data.data(), image.compressed.data.size(), contentHash);
+
+        // same pixels under another name, a hash collision gets a texture of its own
+        auto found = m_byContent.find(contentHash);
+        if (found != m_byContent.end() && TextureLoader::matches(found->second, image))
+        {
+            id = found->second;
+            Entry& entry = m_entries[id];
+            ++entry.refs;
+            entry.paths.push_back(path);
+            m_byPath[path] = id;
+            return id;
+        }
+    }
+
+    id = TextureLoader::upload(image);
+    if (!id)
+    {
+        // keep the old behaviour: a texture object even if the file is missing
+        std::cout << "Texture failed to load at path: " << path << std::endl;
+        glGenTextures(1, &id);
+    }
+
+    Entry& entry = m_entries[id];
+    entry.refs = 1;
+    entry.paths.push_back(path);
+    m_byPath[path] = id;
+    // the first texture of a hash keeps it
+    if (contentHash && !m_byContent.count(contentHash))
+    {
+        entry.contentHash = contentHash;
+        m_byContent[contentHash] = id;
+    }
+
+    return id;
+}
+
+inline void TextureCache::release(const unsigned int id)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto found = m_entries.find(id);
+    if (found == m_entries.end() || --found->second.refs > 0)
+        return;
+
+    for (const std::string& path : found->second.paths)
+        m_byPath.erase(path);
+    if (found->second.contentHash)
+        m_byContent.erase(found->second.contentHash);
+    m_entries.erase(found);
+
+    glDeleteTextures(1, &id);
+}
+
+} // namespace model
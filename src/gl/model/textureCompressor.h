@@ -0,0 +1,421 @@
+#pragma once
+
+#include "model/dds.h"
+#include "model/mipmap.h"
+#include "model/model.h"
+#include "model/texture.h"
+#include "util/threadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/*
+Offline block compression of material textures:
+
+    texture_diffuse   -> BC1, BC3 if any texel is not opaque
+    texture_specular  -> BC4 (red channel)
+    texture_height    -> BC4 (red channel)
+    texture_normal    -> BC5 (x, y only: whatever samples it has to rebuild z = sqrt(1 - x*x - y*y),
+                         no shader here reads normal maps yet)
+
+    Every texture gets its full mip chain and is written next to the source as <name>.dds.
+    TextureLoader::decode() picks the .dds up instead of the png as long as it is not older than the source.
+
+    Rows are stored in upload order (stbi flip applied), the same order the png path hands to glTexImage2D.
+    The encoders are the simple, fast kind: principal axis endpoints for BC1, min / max for BC4.
+*/
+
+namespace model
+{
+
+class TextureCompressor
+{
+public:
+    enum eUsage
+    {
+        eCOLOR = 0,
+        eSINGLE,   // one channel: specular, height
+        eNORMAL
+    };
+
+    // 8 bit rgba, tightly packed
+    struct Rgba
+    {
+        int width = 0;
+        int height = 0;
+        std::vector<unsigned char> pixels;
+    };
+
+    static eUsage usage(const std::string& typeName);
+    static std::string compressedPath(const std::string& path);
+
+    // [out] is 8 bytes for BC1 / BC4, 16 for BC3 / BC5. [texels] is 4x4 rgba, row major
+    static void encodeBC1(const unsigned char* texels, unsigned char* out);
+    static void encodeBC3(const unsigned char* texels, unsigned char* out);
+    static void encodeBC4(const unsigned char* values, unsigned char* out);
+    static void encodeBC5(const unsigned char* texels, unsigned char* out);
+
+    // Mipmap::downsample, color in linear space, normals are renormalized
+    static Rgba downsample(const Rgba& image, const eUsage usage);
+    // every level down to 1x1
+    static dds::Texture compress(const Rgba& image, const dds::eFormat format, const eUsage usage);
+
+    static bool bakeTexture(const std::string& path, const eUsage usage);
+    // every texture of the model's materials, returns how many were written
+    static int bakeModel(const std::string& path);
+};
+
+//////////////////// IMPLEMENTATION ////////////////////
+
+inline TextureCompressor::eUsage TextureCompressor::usage(const std::string& typeName)
+{
+    if (typeName == "texture_normal")
+        return eNORMAL;
+    if (typeName == "texture_specular" || typeName == "texture_height")
+        return eSINGLE;
+    return eCOLOR;
+}
+
+inline std::string TextureCompressor::compressedPath(const std::string& path)
+{
+    return std::filesystem::path(path).replace_extension(".dds").string();
+}
+
+namespace detail
+{
+
+inline uint16_t pack565(const float* rgb)
+{
+    const int r = std::min(31, std::max(0, (int)std::lround(rgb[0] * 31.0f / 255.0f)));
+    const int g = std::min(63, std::max(0, (int)std::lround(rgb[1] * 63.0f / 255.0f)));
+    const int b = std::min(31, std::max(0, (int)std::lround(rgb[2] * 31.0f / 255.0f)));
+    return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+inline void unpack565(const uint16_t c, int* rgb)
+{
+    const int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+    rgb[0] = (r << 3) | (r >> 2);
+    rgb[1] = (g << 2) | (g >> 4);
+    rgb[2] = (b << 3) | (b >> 2);
+}
+
+} // namespace detail
+
+inline void TextureCompressor::encodeBC1(const unsigned char* texels, unsigned char* out)
+{
+    // principal axis of the block colors
+    float mean[3] = { 0.0f, 0.0f, 0.0f };
+    for (int i = 0; i < 16; ++i)
+        for (int c = 0; c < 3; ++c)
+            mean[c] += texels[i * 4 + c] / 16.0f;
+
+    float cov[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f }; // rr rg rb gg gb bb
+    for (int i = 0; i < 16; ++i)
+    {
+        const float r = texels[i * 4 + 0] - mean[0];
+        const float g = texels[i * 4 + 1] - mean[1];
+        const float b = texels[i * 4 + 2] - mean[2];
+        cov[0] += r * r; cov[1] += r * g; cov[2] += r * b;
+        cov[3] += g * g; cov[4] += g * b; cov[5] += b * b;
+    }
+
+    float axis[3] = { 1.0f, 1.0f, 1.0f };
+    for (int iteration = 0; iteration < 8; ++iteration)
+    {
+        const float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+        const float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+        const float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+        const float length = std::max(std::max(std::fabs(x), std::fabs(y)), std::fabs(z));
+        if (length < 1e-6f)
+            break; // flat block, any axis will do
+        axis[0] = x / length; axis[1] = y / length; axis[2] = z / length;
+    }
+
+    // extent of the block along the axis
+    float lo = 0.0f, hi = 0.0f;
+    for (int i = 0; i < 16; ++i)
+    {
+        const float t = (texels[i * 4 + 0] - mean[0]) * axis[0] + (texels[i * 4 + 1] - mean[1]) * axis[1] + (texels[i * 4 + 2] - mean[2]) * axis[2];
+        lo = std::min(lo, t);
+        hi = std::max(hi, t);
+    }
+    const float norm = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+    float e0[3], e1[3];
+    for (int c = 0; c < 3; ++c)
+    {
+        e0[c] = mean[c] + axis[c] * hi / std::max(norm, 1e-6f);
+        e1[c] = mean[c] + axis[c] * lo / std::max(norm, 1e-6f);
+    }
+
+    uint16_t c0 = detail::pack565(e0);
+    uint16_t c1 = detail::pack565(e1);
+    if (c0 < c1)
+        std::swap(c0, c1); // c0 > c1 selects the four color mode
+
+    int palette[4][3];
+    detail::unpack565(c0, palette[0]);
+    detail::unpack565(c1, palette[1]);
+    for (int c = 0; c < 3; ++c)
+    {
+        palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+        palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+
+    uint32_t indices = 0;
+    if (c0 != c1)
+    {
+        for (int i = 0; i < 16; ++i)
+        {
+            int best = 0, bestError = 1 << 30;
+            for (int p = 0; p < 4; ++p)
+            {
+                int error = 0;
+                for (int c = 0; c < 3; ++c)
+                {
+                    const int d = texels[i * 4 + c] - palette[p][c];
+                    error += d * d;
+                }
+                if (error < bestError)
+                {
+                    bestError = error;
+                    best = p;
+                }
+            }
+            indices |= (uint32_t)best << (2 * i);
+        }
+    }
+
+    out[0] = (unsigned char)(c0 & 0xFF); out[1] = (unsigned char)(c0 >> 8);
+    out[2] = (unsigned char)(c1 & 0xFF); out[3] = (unsigned char)(c1 >> 8);
+    for (int i = 0; i < 4; ++i)
+        out[4 + i] = (unsigned char)(indices >> (8 * i));
+}
+
+inline void TextureCompressor::encodeBC4(const unsigned char* values, unsigned char* out)
+{
+    const unsigned char hi = *std::max_element(values, values + 16);
+    const unsigned char lo = *std::min_element(values, values + 16);
+
+    // r0 > r1: eight interpolated levels
+    int palette[8] = { hi, lo };
+    for (int i = 2; i < 8; ++i)
+        palette[i] = ((8 - i) * hi + (i - 1) * lo) / 7;
+
+    uint64_t indices = 0;
+    if (hi != lo)
+    {
+        for (int i = 0; i < 16; ++i)
+        {
+            int best = 0, bestError = 256;
+            for (int p = 0; p < 8; ++p)
+            {
+                const int error = std::abs(values[i] - palette[p]);
+                if (error < bestError)
+                {
+                    bestError = error;
+                    best = p;
+                }
+            }
+            indices |= (uint64_t)best << (3 * i);
+        }
+    }
+
+    out[0] = hi;
+    out[1] = lo;
+    for (int i = 0; i < 6; ++i)
+        out[2 + i] = (unsigned char)(indices >> (8 * i));
+}
+
+inline void TextureCompressor::encodeBC3(const unsigned char* texels, unsigned char* out)
+{
+    unsigned char alpha[16];
+    for (int i = 0; i < 16; ++i)
+        alpha[i] = texels[i * 4 + 3];
+
+    // alpha block is BC4, the color block BC1 (always four color mode here)
+    encodeBC4(alpha, out);
+    encodeBC1(texels, out + 8);
+}
+
+inline void TextureCompressor::encodeBC5(const unsigned char* texels, unsigned char* out)
+{
+    unsigned char x[16], y[16];
+    for (int i = 0; i < 16; ++i)
+    {
+        x[i] = texels[i * 4 + 0];
+        y[i] = texels[i * 4 + 1];
+    }
+    encodeBC4(x, out);
+    encodeBC4(y, out + 8);
+}
+
+inline TextureCompressor::Rgba TextureCompressor::downsample(const Rgba& image, const eUsage usage)
+{
+    Rgba half;
+    half.width  = std::max(1, image.width / 2);
+    half.height = std::max(1, image.height / 2);
+    half.pixels.resize((size_t)half.width * half.height * 4);
+    Mipmap::downsample(image.pixels.data(), image.width, image.height, 4, usage == eCOLOR, half.pixels.data());
+
+    if (usage == eNORMAL)
+    {
+        // the average of unit vectors is shorter than one
+        for (size_t i = 0; i < half.pixels.size(); i += 4)
+        {
+            unsigned char* dst = &half.pixels[i];
+            float n[3];
+            for (int c = 0; c < 3; ++c)
+                n[c] = dst[c] / 127.5f - 1.0f;
+            const float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            if (length > 1e-6f)
+            {
+                for (int c = 0; c < 3; ++c)
+                    dst[c] = (unsigned char)std::lround((n[c] / length + 1.0f) * 127.5f);
+            }
+        }
+    }
+    return half;
+}
+
+inline dds::Texture TextureCompressor::compress(const Rgba& image, const dds::eFormat format, const eUsage usage)
+{
+    dds::Texture texture;
+    texture.format = format;
+
+    Rgba level;
+    const Rgba* current = &image;
+    for (;;)
+    {
+        const int width = current->width, height = current->height;
+        const size_t blockSize = dds::blockSize(format);
+        const int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+
+        const size_t offset = texture.data.size();
+        texture.levels.push_back({ width, height, offset, dds::levelSize(format, width, height) });
+        texture.data.resize(offset + texture.levels.back().size);
+
+        // block rows are independent
+        util::defaultPool().parallelFor(blocksY, [&](const size_t by)
+        {
+            unsigned char texels[64];
+            for (int bx = 0; bx < blocksX; ++bx)
+            {
+                // edge blocks repeat the last row / column
+                for (int i = 0; i < 16; ++i)
+                {
+                    const int x = std::min(bx * 4 + i % 4, width - 1);
+                    const int y = std::min((int)by * 4 + i / 4, height - 1);
+                    std::copy_n(&current->pixels[((size_t)y * width + x) * 4], 4, &texels[i * 4]);
+                }
+
+                unsigned char* out = &texture.data[offset + ((size_t)by * blocksX + bx) * blockSize];
+                switch (format)
+                {
+                case dds::eBC1: encodeBC1(texels, out); break;
+                case dds::eBC3: encodeBC3(texels, out); break;
+                case dds::eBC5: encodeBC5(texels, out); break;
+                default:
+                {
+                    unsigned char red[16];
+                    for (int i = 0; i < 16; ++i)
+                        red[i] = texels[i * 4];
+                    encodeBC4(red, out);
+                }
+                }
+            }
+        });
+
+        if (width == 1 && height == 1)
+            break;
+        level = downsample(*current, usage);
+        current = &level;
+    }
+    return texture;
+}
+
+inline bool TextureCompressor::bakeTexture(const std::string& path, const eUsage usage)
+{
+    Rgba image;
+    int components = 0;
+    unsigned char* pixels = stbi_load(path.c_str(), &image.width, &image.height, &components, 4);
+    if (!pixels)
+    {
+        std::cout << "ERROR::TEXTURE_COMPRESSOR:: failed to load " << path << std::endl;
+        return false;
+    }
+    image.pixels.assign(pixels, pixels + (size_t)image.width * image.height * 4);
+    stbi_image_free(pixels);
+
+    dds::eFormat format = dds::eBC1;
+    if (usage == eNORMAL)
+        format = dds::eBC5;
+    else if (usage == eSINGLE)
+        format = dds::eBC4;
+    else
+    {
+        for (size_t i = 3; i < image.pixels.size(); i += 4)
+        {
+            if (image.pixels[i] != 255)
+            {
+                format = dds::eBC3;
+                break;
+            }
+        }
+    }
+
+    const dds::Texture texture = compress(image, format, usage);
+    if (!dds::write(compressedPath(path), texture))
+    {
+        std::cout << "ERROR::TEXTURE_COMPRESSOR:: failed to write " << compressedPath(path) << std::endl;
+        return false;
+    }
+
+    std::cout << path << ": " << image.width << "x" << image.height << ", " << texture.levels.size() << " levels, "
+              << image.pixels.size() / 1024 << " KB -> " << texture.data.size() / 1024 << " KB" << std::endl;
+    return true;
+}
+
+inline int TextureCompressor::bakeModel(const std::string& path)
+{
+    // materials only: no post processing, none of the mesh work of Model::importScene()
+    Assimp::Importer importer;
+    const aiScene* scene = importer.ReadFile(path, 0);
+    if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE)
+    {
+        std::cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << std::endl;
+        return 0;
+    }
+
+    // every file once, the first material that uses it decides the format. Materials no mesh uses are not loaded
+    // either, so they are not baked
+    const std::string directory = path.substr(0, path.find_last_of('/'));
+    std::vector<std::string> paths;
+    std::vector<eUsage> usages;
+    for (unsigned int m = 0; m < scene->mNumMeshes; ++m)
+    {
+        for (const Texture& texture : Model::materialTextures(scene->mMaterials[scene->mMeshes[m]->mMaterialIndex]))
+        {
+            const std::string file = TextureCache::resolve(directory, texture.name);
+            if (std::find(paths.begin(), paths.end(), file) != paths.end())
+                continue;
+            paths.push_back(file);
+            usages.push_back(usage(texture.type));
+        }
+    }
+
+    // same row order as the png path
+    stbi_set_flip_vertically_on_load(true);
+
+    int baked = 0;
+    for (size_t i = 0; i < paths.size(); ++i)
+        baked += bakeTexture(paths[i], usages[i]) ? 1 : 0;
+    return baked;
+}
+
+} // namespace model
@@ -0,0 +1,321 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/*
+Vertex: the full float layout Assimp's data is converted to.
+
+Packed vertex, 32 bytes instead of the 88 of Vertex:
+
+    position    3 x unorm16     relative to the mesh AABB, the shader gets offset / scale as uniforms
+    normal      2 x snorm16     octahedral
+    texCoords   2 x half        repeat / tiled UVs stay exact enough, unorm16 would clamp them
+    tangent     4 x snorm16     unit quaternion of the frame (tangent, normal x tangent, normal), q and -q are
+                                the same rotation so the sign of w is free to carry the bitangent sign
+    bones       4 x uint8 ids, 4 x unorm8 weights
+
+    resources/shader/packed.vs decodes the position. The first shader lighting with normals / tangents decodes
+    them too: the normal as VertexPacker::octDecode() does, the tangent as q * (1, 0, 0).
+
+VertexLayout: the attributes a mesh actually uploads, interleaved in either format. A mesh only stores what the
+program reads (ShaderManager::activeAttributes()) and what it has (no bones from processMesh, tangents only
+with a normal map).
+*/
+
+namespace model
+{
+
+#define MAX_BONE_INFLUENCE 4
+
+// shader locations, also the bits of an attribute mask
+enum eAttribute
+{
+    ePOSITION = 0,
+    eNORMAL,
+    eTEXCOORDS,
+    eTANGENT,
+    eBITANGENT,
+    eBONE_IDS,
+    eWEIGHTS,
+    eATTRIBUTE_COUNT
+};
+const unsigned int ALL_ATTRIBUTES = (1u << eATTRIBUTE_COUNT) - 1;
+
+struct Vertex 
+{
+    glm::vec3 Position;
+    glm::vec3 Normal;
+    glm::vec2 TexCoords;
+    glm::vec3 Tangent;
+    glm::vec3 Bitangent;
+    //bone indexes which will influence this vertex
+    int m_BoneIDs[MAX_BONE_INFLUENCE];
+    //weights from each bone
+    float m_Weights[MAX_BONE_INFLUENCE];
+};
+
+struct PackedVertex
+{
+    uint16_t position[3];
+    uint16_t pad;
+    int16_t  normal[2];
+    uint16_t texCoords[2];
+    int16_t  tangent[4];
+    uint8_t  boneIds[4];
+    uint8_t  weights[4];
+};
+
+class VertexPacker
+{
+public:
+    // quantization box of [count] vertices: position = offset + scale * unorm
+    static void bounds(const Vertex* vertices, const size_t count, glm::vec3& offset, glm::vec3& scale);
+    // only the attributes in [attributes] are computed, the rest stays 0
+    static PackedVertex pack(const Vertex& vertex, const glm::vec3& offset, const glm::vec3& scale, const unsigned int attributes = ALL_ATTRIBUTES);
+
+    static glm::vec2 octEncode(const glm::vec3& n);
+    static glm::vec3 octDecode(const glm::vec2& e);
+    // quaternion, the sign of w is the bitangent sign
+    static glm::quat tangentFrame(const glm::vec3& normal, const glm::vec3& tangent, const glm::vec3& bitangent);
+
+private:
+    static int16_t snorm16(const float v) { return (int16_t)std::lround(std::min(1.0f, std::max(-1.0f, v)) * 32767.0f); }
+};
+
+class VertexLayout
+{
+public:
+    // the packed format has no bitangent, it is rebuilt from the tangent frame
+    VertexLayout(const unsigned int attributes, const bool packed);
+
+    unsigned int attributes() const { return m_attributes; }
+    bool packed() const { return m_packed; }
+    size_t stride() const { return m_stride; }
+
+    // interleaves the attributes of [count] vertices into [dst], count * stride() bytes.
+    // offset / scale: quantization box of the packed positions, see VertexPacker::bounds()
+    void write(const Vertex* vertices, const size_t count, const glm::vec3& offset, const glm::vec3& scale, unsigned char* dst) const;
+    // attribute pointers into the bound GL_ARRAY_BUFFER, the other locations are left alone so
+    // several layouts (streams) can feed one vertex array
+    void setupAttributes(const size_t baseOffset = 0) const;
+
+private:
+    struct Format
+    {
+        GLint     components;
+        GLenum    type;
+        GLboolean normalized;
+        bool      integer;
+        size_t    source; // offset in Vertex / PackedVertex
+        size_t    size;   // 0: not part of this format
+    };
+    static const Format& format(const int attribute, const bool packed);
+
+private:
+    unsigned int m_attributes;
+    bool         m_packed;
+    size_t       m_stride = 0;
+    size_t       m_offsets[eATTRIBUTE_COUNT] = {};
+};
+
+//////////////////// IMPLEMENTATION ////////////////////
+
+inline glm::vec2 VertexPacker::octEncode(const glm::vec3& n)
+{
+    const float sum = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+    if (sum == 0.0f)
+        return glm::vec2(0.0f);
+
+    glm::vec2 e = glm::vec2(n.x, n.y) / sum;
+    if (n.z < 0.0f)
+    {
+        // fold the lower hemisphere over the diagonals
+        const glm::vec2 folded = (1.0f - glm::abs(glm::vec2(e.y, e.x))) * glm::vec2(e.x >= 0.0f ? 1.0f : -1.0f, e.y >= 0.0f ? 1.0f : -1.0f);
+        e = folded;
+    }
+    return e;
+}
+
+inline glm::vec3 VertexPacker::octDecode(const glm::vec2& e)
+{
+    glm::vec3 n(e.x, e.y, 1.0f - std::fabs(e.x) - std::fabs(e.y));
+    const float t = std::max(-n.z, 0.0f);
+    n.x += n.x >= 0.0f ? -t : t;
+    n.y += n.y >= 0.0f ? -t : t;
+    return glm::normalize(n);
+}
+
+inline glm::quat VertexPacker::tangentFrame(const glm::vec3& normal, const glm::vec3& tangent, const glm::vec3& bitangent)
+{
+    // orthonormal frame around the normal
+    const float normalLength = glm::length(normal);
+    const glm::vec3 n = normalLength > 0.0f ? normal / normalLength : glm::vec3(0.0f, 0.0f, 1.0f);
+    glm::vec3 t = tangent - n * glm::dot(n, tangent);
+    if (glm::dot(t, t) < 1e-12f)
+        t = std::fabs(n.x) < 0.9f ? glm::cross(n, glm::vec3(1.0f, 0.0f, 0.0f)) : glm::cross(n, glm::vec3(0.0f, 1.0f, 0.0f));
+    t = glm::normalize(t);
+    const glm::vec3 b = glm::cross(n, t);
+
+    glm::quat q = glm::quat_cast(glm::mat3(t, b, n));
+    if (q.w < 0.0f)
+        q = -q;
+    // w must not quantize to 0, or the sign is lost
+    q.w = std::max(q.w, 1.0f / 32767.0f);
+
+    // mirrored uv: the real bitangent points the other way
+    if (glm::dot(b, bitangent) < 0.0f)
+        q = -q;
+    return q;
+}
+
+inline PackedVertex VertexPacker::pack(const Vertex& vertex, const glm::vec3& offset, const glm::vec3& scale, const unsigned int attributes)
+{
+    PackedVertex packed = {};
+    for (int c = 0; c < 3; ++c)
+    {
+        const float unorm = scale[c] > 0.0f ? (vertex.Position[c] - offset[c]) / scale[c] : 0.0f;
+        packed.position[c] = (uint16_t)std::lround(std::min(1.0f, std::max(0.0f, unorm)) * 65535.0f);
+    }
+
+    if (attributes & (1u << eNORMAL))
+    {
+        const glm::vec2 normal = octEncode(vertex.Normal);
+        packed.normal[0] = snorm16(normal.x);
+        packed.normal[1] = snorm16(normal.y);
+    }
+
+    if (attributes & (1u << eTEXCOORDS))
+    {
+        const uint32_t uv = glm::packHalf2x16(vertex.TexCoords);
+        packed.texCoords[0] = (uint16_t)(uv & 0xFFFF);
+        packed.texCoords[1] = (uint16_t)(uv >> 16);
+    }
+
+    if (attributes & (1u << eTANGENT))
+    {
+        const glm::quat frame = tangentFrame(vertex.Normal, vertex.Tangent, vertex.Bitangent);
+        packed.tangent[0] = snorm16(frame.x);
+        packed.tangent[1] = snorm16(frame.y);
+        packed.tangent[2] = snorm16(frame.z);
+        packed.tangent[3] = snorm16(frame.w);
+    }
+
+    if (attributes & ((1u << eBONE_IDS) | (1u << eWEIGHTS)))
+    {
+        for (int i = 0; i < 4; ++i)
+        {
+            packed.boneIds[i] = (uint8_t)std::min(255, std::max(0, vertex.m_BoneIDs[i]));
+            const float weight = vertex.m_Weights[i] >= 0.0f ? std::min(1.0f, vertex.m_Weights[i]) : 0.0f; // NaN too
+            packed.weights[i] = (uint8_t)std::lround(weight * 255.0f);
+        }
+    }
+    return packed;
+}
+
+inline void VertexPacker::bounds(const Vertex* vertices, const size_t count, glm::vec3& offset, glm::vec3& scale)
+{
+    if (count == 0)
+    {
+        offset = scale = glm::vec3(0.0f);
+        return;
+    }
+
+    glm::vec3 lo = vertices[0].Position, hi = vertices[0].Position;
+    for (size_t i = 1; i < count; ++i)
+    {
+        lo = glm::min(lo, vertices[i].Position);
+        hi = glm::max(hi, vertices[i].Position);
+    }
+    offset = lo;
+    scale = hi - lo;
+}
+
+inline const VertexLayout::Format& VertexLayout::format(const int attribute, const bool packed)
+{
+    static const Format FLOAT_FORMATS[eATTRIBUTE_COUNT] = {
+        { 3, GL_FLOAT, GL_FALSE, false, offsetof(Vertex, Position),  sizeof(glm::vec3) },
+        { 3, GL_FLOAT, GL_FALSE, false, offsetof(Vertex, Normal),    sizeof(glm::vec3) },
+        { 2, GL_FLOAT, GL_FALSE, false, offsetof(Vertex, TexCoords), sizeof(glm::vec2) },
+        { 3, GL_FLOAT, GL_FALSE, false, offsetof(Vertex, Tangent),   sizeof(glm::vec3) },
+        { 3, GL_FLOAT, GL_FALSE, false, offsetof(Vertex, Bitangent), sizeof(glm::vec3) },
+        { 4, GL_INT,   GL_FALSE, true,  offsetof(Vertex, m_BoneIDs), sizeof(int) * MAX_BONE_INFLUENCE },
+        { 4, GL_FLOAT, GL_FALSE, false, offsetof(Vertex, m_Weights), sizeof(float) * MAX_BONE_INFLUENCE } };
+    static const Format PACKED_FORMATS[eATTRIBUTE_COUNT] = {
+        { 3, GL_UNSIGNED_SHORT, GL_TRUE,  false, offsetof(PackedVertex, position),  sizeof(uint16_t) * 4 }, // with the pad, keeps 4 byte alignment
+        { 2, GL_SHORT,          GL_TRUE,  false, offsetof(PackedVertex, normal),    sizeof(int16_t) * 2 },
+        { 2, GL_HALF_FLOAT,     GL_FALSE, false, offsetof(PackedVertex, texCoords), sizeof(uint16_t) * 2 },
+        { 4, GL_SHORT,          GL_TRUE,  false, offsetof(PackedVertex, tangent),   sizeof(int16_t) * 4 },
+        { 0, GL_NONE,           GL_FALSE, false, 0, 0 },
+        { 4, GL_UNSIGNED_BYTE,  GL_FALSE, true,  offsetof(PackedVertex, boneIds),   sizeof(uint8_t) * 4 },
+        { 4, GL_UNSIGNED_BYTE,  GL_TRUE,  false, offsetof(PackedVertex, weights),   sizeof(uint8_t) * 4 } };
+
+    return packed ? PACKED_FORMATS[attribute] : FLOAT_FORMATS[attribute];
+}
+
+inline VertexLayout::VertexLayout(const unsigned int attributes, const bool packed)
+    : m_attributes(0), m_packed(packed)
+{
+    for (int a = 0; a < eATTRIBUTE_COUNT; ++a)
+    {
+        const Format& f = format(a, packed);
+        if (!(attributes & (1u << a)) || f.size == 0)
+            continue;
+
+        m_attributes |= 1u << a;
+        m_offsets[a] = m_stride;
+        m_stride += f.size;
+    }
+}
+
+inline void VertexLayout::write(const Vertex* vertices, const size_t count, const glm::vec3& offset, const glm::vec3& scale, unsigned char* dst) const
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        PackedVertex packed;
+        const unsigned char* source = (const unsigned char*)&vertices[i];
+        if (m_packed)
+        {
+            packed = VertexPacker::pack(vertices[i], offset, scale, m_attributes);
+            source = (const unsigned char*)&packed;
+        }
+
+        unsigned char* out = dst + i * m_stride;
+        for (int a = 0; a < eATTRIBUTE_COUNT; ++a)
+        {
+            if (m_attributes & (1u << a))
+            {
+                const Format& f = format(a, m_packed);
+                std::memcpy(out + m_offsets[a], source + f.source, f.size);
+            }
+        }
+    }
+}
+
+inline void VertexLayout::setupAttributes(const size_t baseOffset) const
+{
+    for (int a = 0; a < eATTRIBUTE_COUNT; ++a)
+    {
+        if (!(m_attributes & (1u << a)))
+            continue;
+
+        const Format& f = format(a, m_packed);
+        const void* pointer = (const void*)(baseOffset + m_offsets[a]);
+        glEnableVertexAttribArray(a);
+        if (f.integer)
+            glVertexAttribIPointer(a, f.components, f.type, (GLsizei)m_stride, pointer);
+        else
+            glVertexAttribPointer(a, f.components, f.type, f.normalized, (GLsizei)m_stride, pointer);
+    }
+}
+
+} // namespace model
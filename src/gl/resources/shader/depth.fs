@@ -0,0 +1,6 @@
+#version 330 core
+
+// depth prepass / shadow maps: paired with vertex.vs or packed.vs, color writes are masked off
+void main()
+{
+}
\ No newline at end of file
@@ -0,0 +1,28 @@
+#version 330 core
+// model::PackedVertex, see model/vertexFormat.h
+layout (location = 0) in vec3 aPos;         // unorm16, relative to the mesh AABB
+layout (location = 1) in vec2 aNormal;      // octahedral snorm16
+layout (location = 2) in vec2 aTexCoords;   // half
+layout (location = 3) in vec4 aTangent;     // snorm16 quaternion, sign of w = bitangent sign
+layout (location = 7) in vec4 aInstance0;   // rows of the instance's world matrix, model::InstanceBuffer
+layout (location = 8) in vec4 aInstance1;
+layout (location = 9) in vec4 aInstance2;
+
+out vec2 TexCoords;
+invariant gl_Position; // same depth in the prepass (depth.fs) and the color pass
+
+uniform mat4 model;
+uniform bool instanced; // the world matrix comes from aInstance0..2 instead of model
+uniform mat4 view;
+uniform mat4 projection;
+
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+
+void main()
+{
+    mat4 world = instanced ? transpose(mat4(aInstance0, aInstance1, aInstance2, vec4(0.0, 0.0, 0.0, 1.0))) : model;
+    TexCoords = aTexCoords;
+    vec3 position = positionOffset + positionScale * aPos;
+    gl_Position = projection * view * world * vec4(position, 1.0);
+}
\ No newline at end of file
@@ -111,6 +111,29 @@ void ShaderManager::checkCompileErrors(const GLuint shader, const eShaderType ty
     }
 }
 
+unsigned int ShaderManager::activeAttributes() const
+{
+    GLint count = 0, maxLength = 0;
+    glGetProgramiv(m_id, GL_ACTIVE_ATTRIBUTES, &count);
+    glGetProgramiv(m_id, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &maxLength);
+
+    unsigned int mask = 0;
+    std::string name(maxLength > 0 ? maxLength : 1, '\0');
+    for (GLint i = 0; i < count; ++i)
+    {
+        GLsizei length = 0;
+        GLint size = 0;
+        GLenum type = 0;
+        glGetActiveAttrib(m_id, (GLuint)i, (GLsizei)name.size(), &length, &size, &type, &name[0]);
+
+        // built-ins like gl_VertexID have no location
+        const GLint location = glGetAttribLocation(m_id, name.c_str());
+        if (location >= 0 && location < 32)
+            mask |= 1u << location;
+    }
+    return mask;
+}
+
 // utility uniform functions
 void ShaderManager::setBool(const std::string &name, bool value) const
 {
@@ -28,6 +28,9 @@ public:
     inline unsigned int getId() const {return m_id;}
     inline void use() { glUseProgram(m_id); }
 
+    // bit n set when the linked program reads the vertex attribute at location n
+    unsigned int activeAttributes() const;
+
     // utility uniform functions
     void setBool(const std::string& name, bool value) const;
     void setInt(const std::string& name, int value) const;
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+namespace util
+{
+
+// 64 bit words, each one mixed before it is folded in so every input bit reaches every state bit, the tail
+// packed into one last word, then a final avalanche. fast, not cryptographic
+uint64_t hash(const void* data, const size_t size, uint64_t seed = 14695981039346656037ull);
+// murmur3 finalizer, a bijection of 64 bit values
+uint64_t mix(uint64_t value);
+
+//////////////////// IMPLEMENTATION ////////////////////
+
+inline uint64_t mix(uint64_t value)
+{
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdull;
+    value ^= value >> 33;
+    value *= 0xc4ceb9fe1a85ec53ull;
+    value ^= value >> 33;
+    return value;
+}
+
+inline uint64_t hash(const void* data, const size_t size, uint64_t seed)
+{
+    const uint64_t prime = 1099511628211ull;
+    const unsigned char* bytes = (const unsigned char*)data;
+
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, bytes + i, 8);
+        seed = (seed ^ mix(word)) * prime;
+        seed = (seed << 29) | (seed >> 35);
+    }
+    if (i < size)
+    {
+        uint64_t tail = 0;
+        std::memcpy(&tail, bytes + i, size - i);
+        seed = (seed ^ mix(tail ^ ((uint64_t)(size - i) << 56))) * prime;
+    }
+
+    return mix(seed ^ size);
+}
+
+} // namespace util
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+Thread pool:
+
+    * a fixed set of workers fed from one FIFO queue
+    * submit() for single jobs, parallelFor() for index ranges
+    * the thread calling parallelFor() works on the range too and only waits for the indices, not for the helpers,
+      so a parallelFor() nested inside a job can't deadlock the pool
+
+    None of the workers own a GL context: jobs must not call GL.
+*/
+
+namespace util
+{
+
+class ThreadPool
+{
+public:
+    // one thread is left for the caller
+    explicit ThreadPool(unsigned int threads = std::max(2u, std::thread::hardware_concurrency()) - 1);
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    ~ThreadPool();
+
+    unsigned int size() const { return (unsigned int)m_workers.size(); }
+
+    template <typename F>
+    auto submit(F&& job) -> std::future<decltype(job())>;
+
+    // job(i) for every i in [0, count), returns once all of them are done
+    template <typename F>
+    void parallelFor(const size_t count, F&& job);
+
+private:
+    void enqueue(std::function<void()> job);
+    void workerLoop();
+
+private:
+    std::vector<std::thread> m_workers;
+    std::deque<std::function<void()>> m_queue;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    bool m_stop = false;
+};
+
+// process wide pool, created on first use
+ThreadPool& defaultPool();
+
+//////////////////// IMPLEMENTATION ////////////////////
+
+inline ThreadPool::ThreadPool(unsigned int threads)
+{
+    for (unsigned int i = 0; i < threads; ++i)
+        m_workers.emplace_back([this] { workerLoop(); });
+}
+
+inline ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+
+    for (std::thread& worker : m_workers)
+        worker.join();
+}
+
+template <typename F>
+auto ThreadPool::submit(F&& job) -> std::future<decltype(job())>
+{
+    using Result = decltype(job());
+
+    // std::function needs a copyable target
+    auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(job));
+    std::future<Result> future = task->get_future();
+    enqueue([task] { (*task)(); });
+    return future;
+}
+
+template <typename F>
+void ThreadPool::parallelFor(const size_t count, F&& job)
+{
+    if (count == 0)
+        return;
+
+    struct State
+    {
+        std::atomic<size_t> next{ 0 };
+        std::atomic<size_t> done{ 0 };
+        std::mutex mutex;
+        std::condition_variable finished;
+    };
+    auto state = std::make_shared<State>();
+
+    // helpers may start after the range is finished: they only ever call job for an index < count,
+    // and the caller is still waiting for that index then
+    auto work = [state, count, &job]
+    {
+        size_t finished = 0;
+        for (size_t i = state->next++; i < count; i = state->next++)
+        {
+            job(i);
+            ++finished;
+        }
+        if (finished && state->done.fetch_add(finished) + finished == count)
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->finished.notify_all();
+        }
+    };
+
+    const size_t helpers = std::min<size_t>(m_workers.size(), count - 1);
+    for (size_t i = 0; i < helpers; ++i)
+        enqueue(work);
+    work();
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->finished.wait(lock, [&] { return state->done.load() == count; });
+}
+
+inline void ThreadPool::enqueue(std::function<void()> job)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queue.push_back(std::move(job));
+    }
+    m_wake.notify_one();
+}
+
+inline void ThreadPool::workerLoop()
+{
+    for (;;)
+    {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+            if (m_stop && m_queue.empty())
+                return;
+
+            job = std::move(m_queue.front());
+            m_queue.pop_front();
+        }
+        job();
+    }
+}
+
+inline ThreadPool& defaultPool()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+} // namespace util